@@ -0,0 +1,36 @@
+#version 430 core
+
+// Last upsample fused with hdr.fs. Instead of adding the tent of level 1
+// into level 0 and sampling level 0 in a screen pass, both are evaluated per
+// surface pixel and composited with the color attachment in one dispatch.
+// The rgba8 store clamps like the default framebuffer does for hdr.fs.
+layout (local_size_x = 8, local_size_y = 8) in;
+layout (rgba8, binding = 0) uniform writeonly image2D u_output;
+uniform sampler2D u_color;
+uniform sampler2D u_bloom;
+uniform sampler2D u_bloomNext;
+uniform vec2  u_filterRadius;
+uniform int   u_bloomLevels;
+uniform float u_bloomStrength;
+
+vec3 tent(sampler2D src, vec2 uv, vec2 r) { 
+  vec3 result = textureLod(src, uv, 0.0).rgb * 4.0;
+  result += (textureLod(src, uv + vec2(0, r.y), 0.0).rgb + textureLod(src, uv - vec2(0, r.y), 0.0).rgb +
+             textureLod(src, uv + vec2(r.x, 0), 0.0).rgb + textureLod(src, uv - vec2(r.x, 0), 0.0).rgb) * 2.0;
+  result += textureLod(src, uv + r, 0.0).rgb + textureLod(src, uv - r, 0.0).rgb +
+            textureLod(src, uv + vec2(r.x, -r.y), 0.0).rgb + textureLod(src, uv + vec2(-r.x, r.y), 0.0).rgb;
+  return result * (1.0 / 16.0);
+}
+
+void main() { 
+  ivec2 p    = ivec2(gl_GlobalInvocationID.xy);
+  ivec2 size = imageSize(u_output);
+  if(any(greaterThanEqual(p, size))) return;
+
+  vec2 uv    = (vec2(p) + 0.5) / vec2(size);
+  vec3 bloom = textureLod(u_bloom, uv, 0.0).rgb;
+  if(u_bloomLevels > 1) bloom += tent(u_bloomNext, uv, u_filterRadius);
+
+  vec3 color = texelFetch(u_color, p, 0).rgb + bloom * u_bloomStrength;
+  imageStore(u_output, p, vec4(color, 1.0));
+}
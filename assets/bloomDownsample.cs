@@ -0,0 +1,44 @@
+#version 430 core
+
+// Compute version of downsample.fs. Every group writes TILE x TILE texels of
+// the destination level. The 13 taps of a texel sit on the corners between
+// source texels, at half destination texel steps, and neighbouring texels
+// share most of them: the group takes one bilinear sample per corner of its
+// footprint into shared memory first and every texel reads its taps there.
+#define TILE    8
+#define CORNERS (TILE * 2 + 3)
+
+layout (local_size_x = TILE, local_size_y = TILE) in;
+layout (r11f_g11f_b10f, binding = 0) uniform writeonly image2D u_dst;
+uniform sampler2D u_src;
+
+shared vec3 s_corners[CORNERS * CORNERS];
+
+vec3 tap(ivec2 corner, int x, int y) { 
+  return s_corners[(corner.y + y) * CORNERS + corner.x + x];
+}
+
+void main() { 
+  ivec2 size  = imageSize(u_dst);
+  vec2  scale = 0.5 / vec2(size);
+
+  // Corner 2p + 1 is the center of destination texel p, the footprint of the
+  // group spans two corners more on every side
+  ivec2 origin = ivec2(gl_WorkGroupID.xy) * TILE * 2 - 1;
+  for(int i = int(gl_LocalInvocationIndex); i < CORNERS * CORNERS; i += TILE * TILE) { 
+    ivec2 corner = origin + ivec2(i % CORNERS, i / CORNERS);
+    s_corners[i] = textureLod(u_src, vec2(corner) * scale, 0.0).rgb;
+  }
+  barrier();
+
+  ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+  if(any(greaterThanEqual(p, size))) return;
+
+  // Same taps and weights as downsample.fs
+  ivec2 e = ivec2(gl_LocalInvocationID.xy) * 2 + 2;
+  vec3 result = tap(e, 0, 0) * 0.125;
+  result += (tap(e, -2, 2) + tap(e, 2, 2) + tap(e, -2, -2) + tap(e, 2, -2)) * 0.03125;
+  result += (tap(e, 0, 2) + tap(e, -2, 0) + tap(e, 2, 0) + tap(e, 0, -2)) * 0.0625;
+  result += (tap(e, -1, 1) + tap(e, 1, 1) + tap(e, -1, -1) + tap(e, 1, -1)) * 0.125;
+  imageStore(u_dst, p, vec4(result, 1.0));
+}
@@ -0,0 +1,26 @@
+#version 430 core
+
+// Compute version of upsample.fs. The tent of the smaller level is added to
+// the destination in place, replacing the additive blend of the fragment path.
+layout (local_size_x = 8, local_size_y = 8) in;
+layout (r11f_g11f_b10f, binding = 0) uniform image2D u_dst;
+uniform sampler2D u_src;
+uniform vec2 u_filterRadius;
+
+vec3 tent(sampler2D src, vec2 uv, vec2 r) { 
+  vec3 result = textureLod(src, uv, 0.0).rgb * 4.0;
+  result += (textureLod(src, uv + vec2(0, r.y), 0.0).rgb + textureLod(src, uv - vec2(0, r.y), 0.0).rgb +
+             textureLod(src, uv + vec2(r.x, 0), 0.0).rgb + textureLod(src, uv - vec2(r.x, 0), 0.0).rgb) * 2.0;
+  result += textureLod(src, uv + r, 0.0).rgb + textureLod(src, uv - r, 0.0).rgb +
+            textureLod(src, uv + vec2(r.x, -r.y), 0.0).rgb + textureLod(src, uv + vec2(-r.x, r.y), 0.0).rgb;
+  return result * (1.0 / 16.0);
+}
+
+void main() { 
+  ivec2 p    = ivec2(gl_GlobalInvocationID.xy);
+  ivec2 size = imageSize(u_dst);
+  if(any(greaterThanEqual(p, size))) return;
+
+  vec2 uv = (vec2(p) + 0.5) / vec2(size);
+  imageStore(u_dst, p, vec4(imageLoad(u_dst, p).rgb + tent(u_src, uv, u_filterRadius), 1.0));
+}
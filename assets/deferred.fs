@@ -0,0 +1,79 @@
+#version 330 core
+
+// Lighting pass of the deferred path, drawn as a screen quad over one view.
+// Lights come from the cluster grid built on the CPU (lightGridBuild): each
+// pixel only walks the lights binned to its cluster, see lights.glsl.
+in vec2 uv;
+
+uniform sampler2D  u_albedo;
+uniform sampler2D  u_normal;
+uniform sampler2D  u_depth;
+uniform sampler2D  u_envMap;
+uniform mat4  u_invViewProj;
+uniform mat4  u_ViewMat;
+uniform vec3  u_ro;
+
+uniform sampler2DArrayShadow u_shadowMap;
+uniform mat4  u_shadowMats[4];
+uniform vec4  u_shadowSplits;
+uniform int   u_shadowCascades;
+
+layout (location = 0) out vec3 o_color;
+layout (location = 1) out vec3 o_bloom;
+
+vec2 envUV(vec3 rd) { 
+  return vec2(0.2 + 1 * atan(rd.z, rd.x) / (M_PI),0.5 + 1.0 * atan(rd.y, sqrt(rd.x * rd.x + rd.z * rd.z)) / (M_PI));
+}
+
+vec3 octDecode(vec2 f) { 
+  vec3  n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+  float t = clamp(-n.z, 0.0, 1.0);
+  n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+  return normalize(n);
+}
+
+float shadowVisibility(vec4 pos) { 
+  if(u_shadowCascades == 0) return 1.0;
+
+  float depth = -(u_ViewMat * pos).z;
+  int cascade = 0;
+  while(cascade < u_shadowCascades && depth > u_shadowSplits[cascade]) cascade++;
+  if(cascade == u_shadowCascades) return 1.0;
+
+  vec4 p = u_shadowMats[cascade] * pos;
+  return texture(u_shadowMap, vec4(p.xy, float(cascade), p.z));
+}
+
+void main() { 
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  float depth = texelFetch(u_depth, pixel, 0).x;
+  gl_FragDepth = depth;
+  if(depth == 1.0) { 
+    o_color = vec3(0);
+    o_bloom = vec3(0);
+    return;
+  }
+
+  vec4 albedoRoughness = texelFetch(u_albedo, pixel, 0);
+  vec4 normalMetallic  = texelFetch(u_normal, pixel, 0);
+  vec3 albedo    = albedoRoughness.xyz;
+  float roughness = albedoRoughness.w;
+  float metallic  = normalMetallic.z;
+  vec3 N = octDecode(normalMetallic.xy);
+
+  vec4 P = u_invViewProj * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+  P /= P.w;
+  vec3 V = normalize(u_ro - P.xyz);
+
+  // Same environment term as the forward phongShading
+  vec3  R       = reflect(-V, N);
+  vec3  ka      = texture(u_envMap, envUV(R)).xyz;
+  float fresnel = 1 - abs(dot(R, N));
+  fresnel = fresnel * fresnel * 0.6;
+  float shadow = shadowVisibility(P);
+  vec3  color  = (1 - fresnel) * albedo * (0.35 + 0.65 * shadow) + ka * ka * fresnel;
+  color += clusterLights(P.xyz, -(u_ViewMat * P).z, N, V, albedo, roughness, metallic, shadow);
+
+  o_color = color;
+  o_bloom = max(color - 1.0, vec3(0));
+}
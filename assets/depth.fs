@@ -0,0 +1,4 @@
+#version 330 core
+
+// Depth only, the shadow pass has no color attachment
+void main() { }
@@ -0,0 +1,15 @@
+#version 330 core
+layout(location = 0)  in vec3 a_Position;
+
+uniform mat4 u_ViewMat;
+uniform mat4 u_ProjMat;
+uniform mat4 u_WorldMat;
+
+// Same expression as pbr.vs, the depth pre-pass relies on both programs
+// writing bit identical depth for the GL_EQUAL color pass
+invariant gl_Position;
+
+void main() { 
+    vec4 pos = u_WorldMat * vec4(a_Position, 1.0);
+    gl_Position = u_ProjMat * u_ViewMat * pos;
+}
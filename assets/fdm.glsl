@@ -32,6 +32,27 @@ uniform bool iNormalitzarXarxa;
 uniform float iDecayExponent;
 uniform int iExperimentSelector;
 
+// Switches, fdm.cpp compiles variants with these defined as constants so the
+// branches fold away and the net loop gets a fixed trip count
+#ifndef EXPERIMENT
+#define EXPERIMENT iExperimentSelector
+#endif
+#ifndef INTEGRATION_MODE
+#define INTEGRATION_MODE iIntegrationMode
+#endif
+#ifndef DECAY_MODE
+#define DECAY_MODE iDecayMode
+#endif
+#ifndef AMPLADA_FIXA
+#define AMPLADA_FIXA iAmpladaFixa
+#endif
+#ifndef NORMALITZAR_XARXA
+#define NORMALITZAR_XARXA iNormalitzarXarxa
+#endif
+#ifndef NET_N
+#define NET_N N
+#endif
+
 vec3 hsv2rgb(vec3 c) {
     vec4 K = vec4(1.0, 2.0 / 3.0, 1.0 / 3.0, 3.0);
     vec3 p = abs(fract(c.xxx + K.xyz) * 6.0 - K.www);
@@ -72,8 +93,8 @@ float light(vec2 st, float t) {
 	  float f = C / LAMBDA;
 	  float w = f * 2.0 * M_PI;
     float result = sin(l * k - t * w);
-    if(!iIntegrationMode) result = result *0.5 + 0.5;
-    if(iDecayMode) result = result * lightValue(st);
+    if(!INTEGRATION_MODE) result = result *0.5 + 0.5;
+    if(DECAY_MODE) result = result * lightValue(st);
     return result;
 }
 
@@ -125,16 +146,16 @@ float test4(vec2 st, float t)
 
 float net(vec2 st, float off, float t, float separation) { 
 	float result = 0.0;
-  if(iAmpladaFixa)
-    separation = separation / float(N);
-	float offset = -float(N) * separation * 0.5 + off;
-	for(int i = 0; i < N; i++) { 
+  if(AMPLADA_FIXA)
+    separation = separation / float(NET_N);
+	float offset = -float(NET_N) * separation * 0.5 + off;
+	for(int i = 0; i < NET_N; i++) { 
 		result += light(st + vec2(0,offset), t);
 		offset += separation;
 	}
-  if(iNormalitzarXarxa)
-    return result / float(N);
-	return result / float(N);
+  if(NORMALITZAR_XARXA)
+    return result / float(NET_N);
+	return result / float(NET_N);
 }
 
 #define B_SEPARATION 0.01e-3
@@ -163,10 +184,10 @@ float experimentD(vec2 st, float t) {
 }
 
 float experiment(vec2 st, float t) { 
-    if( iExperimentSelector == 0) return experimentA(st, t);
-    if( iExperimentSelector == 1) return experimentB(st, t);
-    if( iExperimentSelector == 2) return experimentC(st, t);
-    if( iExperimentSelector >= 3) return experimentD(st, t);
+    if( EXPERIMENT == 0) return experimentA(st, t);
+    if( EXPERIMENT == 1) return experimentB(st, t);
+    if( EXPERIMENT == 2) return experimentC(st, t);
+    if( EXPERIMENT >= 3) return experimentD(st, t);
 }
 
 float fft(vec2 st, float t) { 
@@ -212,11 +233,24 @@ void old() {
 }
 
 
+#ifdef ACCUMULATE
+//One time sample per frame added to the running sum in iAccumulation
+uniform highp sampler2D iAccumulation;
+uniform float iSampleTime;
+
+void main() { 
+  vec2 st = realSt();
+  float partial = experiment(st, iSampleTime + iTime * TIME_ZOOM);
+  float previous = texelFetch(iAccumulation, ivec2(gl_FragCoord.xy), 0).r;
+  color = vec3(previous + partial * partial);
+}
+#else
 void main() { 
   vec2 st = realSt();
   float result;
-  if(iIntegrationMode) result = executar(st, iTime * TIME_ZOOM);
+  if(INTEGRATION_MODE) result = executar(st, iTime * TIME_ZOOM);
   else result = experiment(st, iTime * TIME_ZOOM);
 
   color = vec3(result);
 }
+#endif
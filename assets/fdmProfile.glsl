@@ -0,0 +1,55 @@
+#version 300 es
+precision highp float;
+precision highp int;
+
+// Line profile of the superposition model, one sample per texel. Samples are
+// laid out row major over a iWidth wide target so counts past the maximum
+// texture size still fit. Same phase reduction as the CPU reduced float mode.
+out float intensity;
+
+#define MAX_SOURCES 128
+#define MAX_STEPS 64
+
+uniform int iCount;
+uniform int iWidth;
+uniform float iStart;
+uniform float iStep;
+uniform float iDistance;
+uniform float iK;
+uniform float iPhaseRef;
+uniform bool iDecayMode;
+uniform float iDecayScale;
+uniform int iSteps;
+uniform float iTimePhase[MAX_STEPS];
+uniform int iSources;
+uniform float iOffset[MAX_SOURCES];
+uniform float iWeight[MAX_SOURCES];
+
+void main() {
+  int i = int(gl_FragCoord.y) * iWidth + int(gl_FragCoord.x);
+  if (i >= iCount) {
+    intensity = 0.0;
+    return;
+  }
+
+  float y = iStart + iStep * float(i);
+  float L = iDistance;
+  float lRef = sqrt(L * L + y * y);
+  float phaseRef = iPhaseRef + mod(y * y / (lRef + L) * iK, 2.0 * 3.1415926535897932384626433832795);
+
+  float result = 0.0;
+  for (int m = 0; m < iSteps; m++) {
+    float field = 0.0;
+    for (int j = 0; j < iSources; j++) {
+      float o = iOffset[j];
+      float yj = y + o;
+      float l = sqrt(L * L + yj * yj);
+      float phase = phaseRef + (2.0 * y + o) * o / (l + lRef) * iK;
+      float amplitude = iWeight[j];
+      if (iDecayMode) amplitude *= iDecayScale / l;
+      field += amplitude * (sin(phase - iTimePhase[m]) * 0.5 + 0.5);
+    }
+    result += field * field;
+  }
+  intensity = result / float(iSteps);
+}
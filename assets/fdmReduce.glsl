@@ -0,0 +1,46 @@
+#version 300 es
+precision highp float;
+precision highp int;
+
+// Reduces iBucket consecutive profile samples per texel into
+// (min, max, index of max, local maxima count). A sample is a local maximum
+// when nothing inside +-iWindow exceeds it, the rule fdmFindPeaks uses. The
+// target is integer so indices stay exact past 2^24 samples, min and max are
+// stored as their float bits.
+out uvec4 result;
+
+uniform highp sampler2D iProfile;
+uniform int iCount;
+uniform int iWidth;
+uniform int iBucket;
+uniform int iWindow;
+
+float fetch(int i) {
+  return texelFetch(iProfile, ivec2(i % iWidth, i / iWidth), 0).r;
+}
+
+void main() {
+  int first = int(gl_FragCoord.x) * iBucket;
+  int last = min(first + iBucket, iCount);
+
+  float minValue = 3.0e38;
+  float maxValue = -3.0e38;
+  int maxIndex = first;
+  uint peaks = 0u;
+
+  for (int i = first; i < last; i++) {
+    float v = fetch(i);
+    minValue = min(minValue, v);
+    if (v > maxValue) {
+      maxValue = v;
+      maxIndex = i;
+    }
+
+    if (i >= iWindow && i + iWindow < iCount) {
+      bool peak = true;
+      for (int j = i - iWindow; j <= i + iWindow && peak; j++) peak = fetch(j) <= v;
+      if (peak) peaks++;
+    }
+  }
+  result = uvec4(floatBitsToUint(minValue), floatBitsToUint(maxValue), uint(maxIndex), peaks);
+}
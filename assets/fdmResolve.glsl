@@ -0,0 +1,11 @@
+#version 300 es
+precision highp float;
+
+// Running mean of the accumulated time samples
+out vec3 color;
+uniform highp sampler2D iAccumulation;
+uniform float iSampleCount;
+
+void main() { 
+  color = vec3(texelFetch(iAccumulation, ivec2(gl_FragCoord.xy), 0).r / iSampleCount);
+}
@@ -1,35 +1,23 @@
 #version 330 core
+#define GAUSS_MAX_TAPS 16
   
 in vec2 uv;
-out vec3 color;
+out vec4 color;
 
 uniform sampler2D u_input;
-uniform bool u_horizontal;
+uniform vec2  u_direction; // One output texel along the blurred axis
+uniform int   u_taps;
+uniform float u_weights[GAUSS_MAX_TAPS];
+uniform float u_offsets[GAUSS_MAX_TAPS];
 
+// Every tap past the center stands for two texels, its offset sits between
+// them so the bilinear fetch returns their weighted sum
 void main()
 {             
-    float w = 1;
-    float f = 0.8;
-    int kernelSize = 8;
-    vec2 tex_offset = 1.0 / textureSize(u_input, 0); // gets size of single texel
-    vec3 result = texture(u_input, uv).rgb * w; // current fragment's contribution
-    if(u_horizontal)
-    {
-        w *= f;
-        for(int i = 1; i < kernelSize; ++i) {
-            result += texture(u_input, uv + vec2(tex_offset.x * i, 0.0)).rgb * w;
-            result += texture(u_input, uv - vec2(tex_offset.x * i, 0.0)).rgb * w;
-            w *= f;
-        }
+    vec4 result = texture(u_input, uv) * u_weights[0];
+    for(int i = 1; i < u_taps; ++i) {
+        vec2 offset = u_direction * u_offsets[i];
+        result += (texture(u_input, uv + offset) + texture(u_input, uv - offset)) * u_weights[i];
     }
-    else
-    {
-        w *= f;
-        for(int i = 1; i < kernelSize; ++i) {
-            result += texture(u_input, uv + vec2(0.0, tex_offset.y * i)).rgb * w;
-            result += texture(u_input, uv - vec2(0.0, tex_offset.y * i)).rgb * w;
-            w *= f;
-        }
-    }
-    color = result * 0.14;
+    color = result;
 }
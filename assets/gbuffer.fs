@@ -0,0 +1,38 @@
+#version 330 core
+
+// G-buffer layout
+//   0 RGBA8   albedo, roughness
+//   1 RGBA16F octahedral normal, metallic, fresnel
+// Position is reconstructed from the depth buffer in assets/deferred.fs
+
+uniform sampler2D u_diffuseTexture;
+uniform sampler2DArray u_diffuseArray;
+uniform int u_diffuseLayer; // Layer of u_diffuseArray, -1 samples u_diffuseTexture
+uniform vec3 u_kd;
+uniform vec3 u_ks; // metallic, roughness, roughness
+uniform bool u_useTextures;
+uniform mat4 u_WorldMat;
+
+in vec4 f_pos;
+in vec3 f_normal;
+in vec2 f_uv;
+layout (location = 0) out vec4 o_albedo;
+layout (location = 1) out vec4 o_normal;
+
+vec2 octWrap(vec2 v) { 
+  return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 octEncode(vec3 n) { 
+  n /= abs(n.x) + abs(n.y) + abs(n.z);
+  return n.z >= 0.0 ? n.xy : octWrap(n.xy);
+}
+
+void main() { 
+  vec3 albedo = u_kd;
+  if(u_useTextures) albedo = u_diffuseLayer >= 0 ? texture(u_diffuseArray, vec3(f_uv, u_diffuseLayer)).xyz : texture(u_diffuseTexture, f_uv).xyz;
+  vec3 normal = normalize(mat3(u_WorldMat) * f_normal);
+
+  o_albedo = vec4(albedo, u_useTextures ? 0.5 : u_ks.y);
+  o_normal = vec4(octEncode(normal), u_useTextures ? 0.0 : u_ks.x, 0.0);
+}
@@ -2,8 +2,10 @@
 in vec2 uv;
 uniform sampler2D u_color;
 uniform sampler2D u_bloom;
+uniform float u_bloomStrength;
 
 out vec3 color;
 void main() { 
-  color = texture2D(u_color, uv).xyz * 1.0 + texture2D(u_bloom, uv).xyz * 0.05;
+  color = texture2D(u_color, uv).xyz * 1.0;
+  if(u_bloomStrength > 0.0) color += texture2D(u_bloom, uv).xyz * u_bloomStrength;
 }
@@ -0,0 +1,70 @@
+// Clustered lights shared by pbr.fs and deferred.fs, the loader inserts this
+// file right after their #version line. See LightGrid in include/video.hpp.
+// Lights are three texels per row: position and radius, color * intensity and
+// type, direction.
+#define M_PI 3.1415
+
+#define LIGHT_POINT       0
+#define LIGHT_DIRECTIONAL 1
+#define LIGHT_HEMI        2
+#define LIGHT_INDEX_WIDTH 1024
+
+uniform sampler2D  u_lights;
+uniform isampler2D u_lightTiles;   // Per cluster: offset, count
+uniform isampler2D u_lightIndices; // LIGHT_INDEX_WIDTH per row, global lights first
+uniform ivec2 u_viewOrigin;
+uniform int   u_tileSize;
+uniform int   u_tilesY;
+uniform int   u_clusterSlices;
+uniform float u_clusterScale;
+uniform float u_clusterBias;
+uniform int   u_lightGlobals;
+
+int lightIndex(int k) { 
+  return texelFetch(u_lightIndices, ivec2(k % LIGHT_INDEX_WIDTH, k / LIGHT_INDEX_WIDTH), 0).x;
+}
+
+// Lambert plus a normalized Blinn-Phong lobe driven by roughness, the shadow
+// map attenuates directional lights
+vec3 evalLight(vec3 P, vec3 N, vec3 V, vec3 albedo, float roughness, float metallic, float shadow, int index) { 
+  vec4 light     = texelFetch(u_lights, ivec2(0, index), 0);
+  vec4 color     = texelFetch(u_lights, ivec2(1, index), 0);
+  vec3 direction = texelFetch(u_lights, ivec2(2, index), 0).xyz;
+  int  type      = int(color.w);
+
+  if(type == LIGHT_HEMI) return albedo * color.xyz * (0.5 - 0.5 * dot(N, direction));
+
+  vec3  L           = -direction;
+  float attenuation = shadow;
+  if(type == LIGHT_POINT) { 
+    L = light.xyz - P;
+    float d = length(L);
+    if(d >= light.w) return vec3(0);
+    L /= d;
+    float window = 1.0 - pow(d / light.w, 4.0);
+    attenuation  = window * window / (d * d + 1.0);
+  }
+
+  float NdotL     = max(dot(N, L), 0.0);
+  float shininess = 2.0 / max(pow(roughness, 4.0), 1e-4) - 2.0;
+  vec3  H         = normalize(L + V);
+  vec3  F0        = mix(vec3(0.04), albedo, metallic);
+  vec3  specular  = F0 * (shininess + 8.0) / (8.0 * M_PI) * pow(max(dot(N, H), 0.0), shininess);
+  vec3  diffuse   = albedo * (1.0 - metallic) / M_PI;
+  return (diffuse + specular) * color.xyz * NdotL * attenuation;
+}
+
+vec3 clusterLights(vec3 P, float viewDepth, vec3 N, vec3 V, vec3 albedo, float roughness, float metallic, float shadow) { 
+  vec3 color = vec3(0);
+  for(int i = 0; i < u_lightGlobals; i++) { 
+    color += evalLight(P, N, V, albedo, roughness, metallic, shadow, lightIndex(i));
+  }
+
+  ivec2 tile  = (ivec2(gl_FragCoord.xy) - u_viewOrigin) / u_tileSize;
+  int   slice = clamp(int(floor(log(max(viewDepth, 1e-4)) * u_clusterScale + u_clusterBias)), 0, u_clusterSlices - 1);
+  ivec2 range = texelFetch(u_lightTiles, ivec2(tile.x, slice * u_tilesY + tile.y), 0).xy;
+  for(int i = 0; i < range.y; i++) { 
+    color += evalLight(P, N, V, albedo, roughness, metallic, shadow, lightIndex(range.x + i));
+  }
+  return color;
+}
@@ -2,6 +2,8 @@
 
 uniform sampler2D u_envMap;
 uniform sampler2D u_diffuseTexture;
+uniform sampler2DArray u_diffuseArray;
+uniform int u_diffuseLayer; // Layer of u_diffuseArray, -1 samples u_diffuseTexture
 uniform sampler2D u_specularTexture;
 uniform sampler2D u_bumpTexture;
 uniform vec3 u_kd;
@@ -13,6 +15,16 @@ uniform vec3 u_rd;
 uniform bool u_isBack;
 uniform int  u_shadingMode;
 uniform bool u_useTextures;
+uniform bool u_clustered;
+uniform mat4 u_ViewMat;
+uniform mat4 u_WorldMat;
+
+// Cascaded shadow map of the first directional light, u_shadowSplits holds
+// the view depth where every cascade ends. Up to 4 cascades, 0 disables it.
+uniform sampler2DArrayShadow u_shadowMap;
+uniform mat4  u_shadowMats[4];
+uniform vec4  u_shadowSplits;
+uniform int   u_shadowCascades;
 
 in vec4 f_pos;
 in vec3 f_normal;
@@ -20,13 +32,12 @@ in vec2 f_uv;
 layout (location = 0) out vec3 o_color;
 layout (location = 1) out vec3 o_bloom;
 
-#define M_PI 3.1415
-
 vec2 envUV(vec3 rd) { 
   return vec2(0.2 + 1 * atan(rd.z, rd.x) / (M_PI),0.5 + 1.0 * atan(rd.y, sqrt(rd.x * rd.x + rd.z * rd.z)) / (M_PI));
 }
 
 vec3 getDiffuse(vec2 st) { 
+  if(u_useTextures && u_diffuseLayer >= 0) { return texture(u_diffuseArray, vec3(st, u_diffuseLayer)).xyz; }
   if(u_useTextures) { return texture2D(u_diffuseTexture, st).xyz; }
   return u_kd;
 }
@@ -38,8 +49,20 @@ vec3 getAmbient(vec2 st) {
   return u_ka;
 }
 
-vec3 phongShading(vec3 I, vec3 L, vec3 N) { 
-  vec3 kd = getDiffuse(f_uv);
+float shadowVisibility() { 
+  if(u_shadowCascades == 0) return 1.0;
+
+  float depth = -(u_ViewMat * f_pos).z;
+  int cascade = 0;
+  while(cascade < u_shadowCascades && depth > u_shadowSplits[cascade]) cascade++;
+  if(cascade == u_shadowCascades) return 1.0;
+
+  vec4 p = u_shadowMats[cascade] * f_pos;
+  return texture(u_shadowMap, vec4(p.xy, float(cascade), p.z));
+}
+
+vec3 phongShading(vec3 I, vec3 L, vec3 N, float shadow) { 
+  vec3 kd = getDiffuse(f_uv) * (0.35 + 0.65 * shadow);
   vec3 R = reflect(I, N);
 
   vec3 ka = texture2D(u_envMap, envUV(R)).xyz;
@@ -64,7 +87,16 @@ vec3 shading() {
   } else {
     vec3 eyeRd = normalize(f_pos.xyz - u_ro);
     if(u_shadingMode == 0) {
-      return phongShading(eyeRd, vec3(1,-1,1), f_normal);
+      // World space like eyeRd, the same normal the G-buffer stores
+      vec3  N      = normalize(mat3(u_WorldMat) * f_normal);
+      float shadow = shadowVisibility();
+      vec3  color  = phongShading(eyeRd, vec3(1,-1,1), N, shadow);
+      if(u_clustered) { 
+        float roughness = u_useTextures ? 0.5 : u_ks.y;
+        float metallic  = u_useTextures ? 0.0 : u_ks.x;
+        color += clusterLights(f_pos.xyz, -(u_ViewMat * f_pos).z, N, -eyeRd, getDiffuse(f_uv), roughness, metallic, shadow);
+      }
+      return color;
     }
   }
   return vec3(0,0,0);
@@ -13,10 +13,18 @@ out vec4 f_pos;
 out vec3 f_normal;
 
 uniform bool u_flatUV;
+uniform bool u_isBack;
+
+// Must match assets/depth.vs for the depth pre-pass
+invariant gl_Position;
+
 void main() { 
 
     f_pos = u_WorldMat * vec4(a_Position, 1.0);
     gl_Position = u_ProjMat * u_ViewMat * f_pos;
+    if(u_isBack) { 
+      gl_Position.z = gl_Position.w;
+    }
     f_uv = a_UV * u_uvScale + u_uvOffset;
     if(u_flatUV) { 
       f_uv = f_pos.xz;
@@ -7,7 +7,7 @@
 // Remember to use a floating-point texture format (for HDR)!
 // Remember to use edge clamping for this texture!
 uniform sampler2D srcTexture;
-uniform float filterRadius;
+uniform vec2 filterRadius;
 
 in vec2 uv;
 layout (location = 0) out vec3 upsample;
@@ -15,9 +15,9 @@ layout (location = 0) out vec3 upsample;
 void main()
 {
     // The filter kernel is applied with a radius, specified in texture
-    // coordinates, so that the radius will vary across mip resolutions.
-    float x = filterRadius;
-    float y = filterRadius;
+    // coordinates of the source mip, so that the radius follows its texels.
+    float x = filterRadius.x;
+    float y = filterRadius.y;
 
     // Take 9 samples around current texel:
     // a - b - c
@@ -34,14 +34,39 @@ inline ENGINE_API float* meshTransformPlaneScreen() {
   return &plane[0][0];
 }
 
-inline ENGINE_API float* viewMatrix(const glm::vec3& camPos, const glm::vec3& camDir) {
-  static glm::mat4 view;
-  view = glm::lookAt(camPos, camPos + camDir, glm::vec3(0, 1, 0));
-  return &view[0][0];
+// Returned by value so several cameras can be built at once from any thread
+inline ENGINE_API glm::mat4 view(const glm::vec3& camPos, const glm::vec3& camDir) {
+  return glm::lookAt(camPos, camPos + camDir, glm::vec3(0, 1, 0));
 }
-inline ENGINE_API float* projMatrix(float ra) {
-  static glm::mat4 proj;
-  proj = glm::perspective(float(M_PI) / 2.0f, ra, 0.5f, 2000.0f);
-  return &proj[0][0];
+inline ENGINE_API glm::mat4 proj(float ra) {
+  return glm::perspective(float(M_PI) / 2.0f, ra, 0.5f, 2000.0f);
 }
+
+/* BATCHED KERNELS */
+// Array versions of the common transforms, implemented in src/engine/linear.cpp
+// with SSE when available. Matrices are glm column major; out may alias the
+// input only where noted.
+struct AABB {
+  glm::vec3 min;
+  glm::vec3 max;
+};
+
+// out[i] = a * b[i], out may alias b
+ENGINE_API void mul(const glm::mat4& a, const glm::mat4* b, glm::mat4* out, int count);
+// out[i] = a[i] * b[i], out may alias a or b
+ENGINE_API void mul(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, int count);
+// out[i] = m * vec4(points[i], 1), out may alias points
+ENGINE_API void transformPoints(const glm::mat4& m, const glm::vec3* points, glm::vec3* out, int count);
+// World bounds of one local box under every transform
+ENGINE_API void transformAABB(const glm::mat4* m, const AABB& box, AABB* out, int count);
+// Inverse of affine transforms (last row 0 0 0 1), out may alias m
+ENGINE_API void inverseAffine(const glm::mat4* m, glm::mat4* out, int count);
+// transpose(inverse(mat3(m[i])))
+ENGINE_API void normalMatrix(const glm::mat4* m, glm::mat3* out, int count);
+
+// Six normalized inward planes (left, right, bottom, top, near, far) of a
+// view projection, a point p is inside when dot(plane, vec4(p, 1)) >= 0
+ENGINE_API void frustumPlanes(const glm::mat4& viewProj, glm::vec4* planes);
+// visible[i] is 0 when boxes[i] is entirely outside one of the six planes
+ENGINE_API void cullAABB(const glm::vec4* planes, const AABB* boxes, unsigned char* visible, int count);
 } // namespace lin
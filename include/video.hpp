@@ -1,6 +1,10 @@
 #pragma once
+#include <cstdint>
 #include <glm/glm.hpp>
+#include <functional>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #define DEBUG
@@ -57,6 +61,31 @@ struct idx_ptr {
   std::vector<T>* container;
 };
 
+// Read only contents of a whole file, mapped when the platform allows it and
+// the file is not small enough to copy. Views of one file share the mapping,
+// it is released with the last view unless the file is still in the cache of
+// recently opened files. data is not null terminated and the view is false
+// when the file could not be read. A mapped view must not outlive an edit
+// that rewrites or truncates the file in place, saving through a rename is
+// safe.
+struct FileView {
+  const char*                 data = nullptr;
+  size_t                      size = 0;
+  std::shared_ptr<const void> owner;
+
+  explicit operator bool() const { return owner != nullptr; }
+  const char*      begin() const { return data; }
+  const char*      end() const { return data + size; }
+  std::string_view str() const { return std::string_view(data, size); }
+};
+
+FileView fileView(const char* path);
+// Starts reading path in the background, a fileView of it then waits at most
+// for the rest of a read in flight and reads the file itself when it is still
+// queued. Prefetched files stay cached until their first view. Does nothing on
+// Emscripten.
+void filePrefetch(const char* path);
+
 struct Texture {
   int   width;
   int   height;
@@ -147,9 +176,124 @@ struct Light {
   glm::vec3 position;
   float     radius;
   LightType type;
+  glm::vec3 color     = glm::vec3(1.0f);
+  float     intensity = 1.0f;
 };
 struct SunLight {
 };
+
+// Point of view with its derived matrices. Parameters are set directly and
+// update() rebuilds view, proj, viewProj and planes from them. jitter offsets
+// the projection in NDC units, 2 / width is one pixel horizontally.
+struct Camera {
+  glm::vec3 position  = glm::vec3(0.0f);
+  glm::vec3 direction = glm::vec3(0.0f, 0.0f, -1.0f);
+  glm::vec3 up        = glm::vec3(0.0f, 1.0f, 0.0f);
+  float     fov       = 1.57079633f; // Vertical, in radians
+  float     ra        = 1.0f;
+  float     zNear     = 0.5f;
+  float     zFar      = 2000.0f;
+  float     orthoSize = 0.0f; // Half height of an orthographic view, 0 is perspective
+  glm::vec2 jitter    = glm::vec2(0.0f);
+
+  glm::mat4 view;
+  glm::mat4 proj;
+  glm::mat4 viewProj;
+  glm::vec4 planes[6]; // Inward facing, see lin::frustumPlanes
+
+  void update();
+};
+
+// Camera and the viewport it is rendered to, in pixels of the bound target
+struct View {
+  Camera camera;
+  int    x      = 0;
+  int    y      = 0;
+  int    width  = 0;
+  int    height = 0;
+};
+
+// Froxel grid over a view: screen tiles of tileSize pixels split in depth by
+// exponential slices between the camera near and far planes. Every cluster
+// lists the POINT lights whose sphere can touch it; DIRECTIONAL and HEMI
+// lights touch everything and are the first globalCount indices.
+//
+// tiles holds an (offset, count) pair into indices per cluster, cluster
+// (x, y, z) is at row z * tilesY + y, column x. A view depth d falls in slice
+// log(d) * sliceScale + sliceBias.
+struct LightGrid {
+  int              tileSize = 32;
+  int              slices   = 16;
+  int              threads  = 0; // 0 uses every core once there are enough lights
+  int              tilesX   = 0;
+  int              tilesY   = 0;
+  float            sliceScale;
+  float            sliceBias;
+  int              globalCount = 0;
+  std::vector<int> tiles;
+  std::vector<int> indices;
+
+  // Scratch, the point lights left after culling with their view space
+  // center, tile rectangle and slice range
+  std::vector<int>        binned;
+  std::vector<glm::vec3>  centers;
+  std::vector<glm::ivec4> rects;
+  std::vector<glm::ivec2> depths;
+};
+
+// Bins the lights for a camera rendering to a width x height viewport
+void lightGridBuild(LightGrid* grid, const Light* lights, int count, const Camera& camera, int width, int height);
+
+// Frame work declared as passes over transient targets. compile() culls the
+// passes whose writes nothing reads, takes the lifetime of every target over
+// the surviving passes and lets targets of equal format and size share one
+// physical texture when their lifetimes do not overlap. Passes run in
+// declaration order, so they can only read targets written before them; a
+// pass blending into a target declares it as a read too.
+enum RenderGraphFormat {
+  RG_FORMAT_RGB16F,
+  RG_FORMAT_R11G11B10F,
+  RG_FORMAT_RGBA8,
+  RG_FORMAT_DEPTH24_STENCIL8
+};
+
+struct RenderGraphTarget {
+  const char*       name;
+  RenderGraphFormat format;
+  glm::ivec2        size;
+  int               first    = -1; // First and last surviving pass using it
+  int               last     = -1;
+  int               physical = -1; // -1 when no surviving pass uses it
+};
+
+struct RenderGraphPass {
+  const char*           name;
+  std::function<void()> execute;
+  std::vector<int>      reads;
+  std::vector<int>      writes;
+  bool                  output  = false; // Draws outside the graph, never culled
+  bool                  compute = false; // Writes through images instead of drawing
+  bool                  culled  = false;
+};
+
+struct RenderGraphPhysical {
+  RenderGraphFormat format;
+  glm::ivec2        size;
+};
+
+struct RenderGraph {
+  std::vector<RenderGraphTarget>   targets;
+  std::vector<RenderGraphPass>     passes;
+  std::vector<RenderGraphPhysical> physical;
+
+  void clear();
+  int  target(const char* name, RenderGraphFormat format, glm::ivec2 size);
+  int  pass(const char* name, std::function<void()> execute, bool output = false);
+  void read(int pass, int target);
+  void write(int pass, int target);
+  void compile();
+};
+
 struct Stage {
   std::vector<Object>              objects;
   std::vector<ObjectInstanceGroup> instances;
@@ -175,6 +319,9 @@ struct Stage {
     instances.emplace_back();
     return idx_ptr<ObjectInstanceGroup>(instances.size() - 1, &instances);
   }
+
+  // Updated camera at camPos looking along camDir
+  Camera camera(float ra) const;
 };
 
 struct Scene {
@@ -267,17 +414,30 @@ typedef struct _RendererDesc {
 
   // The renderer implementation may or may not obey this flags
   int       deferred_enable         = 0;
+  bool      clustered_enable        = 0; // Forward shading of Stage::lights through the cluster grid
   int       hdr_enable              = 0;
   float     bloom_radius            = 1.5f;
   int       bloom_sampling          = 2;
-  bool      bloom_enable            = 0;
+  int       bloom_downscale         = 1; // 1, 2 or 4, the first level is 1 / (2 * bloom_downscale) of the surface
+  float     bloom_strength          = 0.05f;
+  float     bloom_gauss_radius      = 0.0f; // Non zero replaces the mip chain by a half resolution Gaussian of this radius
+  bool      bloom_enable            = 0; // Disabled skips the bright pass writes and the whole chain
+  bool      bloom_compute           = 1; // Compute shader chain and composite when GL 4.3 is available
+  const char* program_cache_path    = ".programCache"; // Linked program binaries, nullptr disables the cache
+  bool      shader_reload_enable    = 0; // Rebuilds programs whose sources change on disk
   bool      shadowmapping_enable    = 0;
   int       shadowmapping_width     = 1024;
   int       shadowmapping_height    = 1024;
+  int       shadowmapping_cascades  = 4;
+  float     shadowmapping_distance  = 200.0f;
   bool      ssao_enable             = 0;
   bool      parallaxmapping_enable  = 0;
   bool      texture_mipmap_enable   = 1;
+  bool      texture_stream_enable   = 0; // Uploads the mip tail first, finer levels follow screen coverage
+  int       texture_stream_budget   = 256; // MiB of resident texture levels, the mip tails always stay
+  int       texture_stream_uploads  = 4; // Levels streamed in per frame
   bool      depth_enable            = 1;
+  bool      depth_prepass_enable    = 0;
   bool      backface_culling_enable = 1;
   bool      cull_back_face          = 1;
   ISurface* surface                 = nullptr;
@@ -286,6 +446,10 @@ typedef struct _RendererDesc {
 struct IRenderer {
   virtual void render(Scene* scene) = 0;
   virtual void upload(Scene* scene) = 0;
+  // Renders the current stage once per view into the bound framebuffer,
+  // without post processing. Per instance work such as world bounds is done
+  // once and shared by every view; cameras must be updated.
+  virtual void renderViews(Scene* scene, const View* views, int count) = 0;
   virtual ~IRenderer() {}
 
   inline RendererDesc& desc() { return _desc; }
@@ -318,7 +482,43 @@ namespace NextVideo {
 void   glUtilRenderScreenQuad();
 void   glUtilsSetVertexAttribs(int index);
 void   glUtilRenderQuad(GLuint vbo, GLuint ebo, GLuint worldMat, GLuint viewMat, GLuint projMat);
-GLuint glUtilLoadProgram(const char* vs, const char* fs);
+// defines, when given, is inserted after the #version line of both stages
+GLuint glUtilLoadProgram(const char* vs, const char* fs, const char* defines = nullptr);
+
+// One program of a glUtilLoadPrograms batch, compute programs set cs and
+// leave vs and fs null. program is 0, or -1 when a source is missing, if
+// the load failed.
+struct GLUtilProgramLoad {
+  const char* vs      = nullptr;
+  const char* fs      = nullptr;
+  const char* cs      = nullptr;
+  const char* defines = nullptr;
+  const char* include = nullptr; // Source file inserted after the #version line of fs or cs
+  GLuint      program = 0;
+  bool        failed  = false;
+
+  // Internal
+  GLuint   shaders[2];
+  uint64_t key;
+  bool     cached;
+};
+
+// Compiles a batch of programs concurrently where the driver allows it
+void glUtilLoadPrograms(GLUtilProgramLoad* loads, int count);
+// Directory for linked program binaries, nullptr disables the cache
+void glUtilProgramCache(const char* directory);
+// Returns 0 on failure, not available on Emscripten builds
+GLuint glUtilLoadComputeProgram(const char* cs, const char* defines = nullptr);
+
+// Rebuilds *program from the sources of load when one of them changes on
+// disk. The new program replaces *program only once it links, and reloaded
+// then runs so uniform locations can be queried again; a build that fails
+// keeps the last good program. Only available on Linux, elsewhere a no-op.
+void glUtilWatchProgram(GLuint* program, const GLUtilProgramLoad& load, std::function<void()> reloaded = nullptr);
+void glUtilUnwatchProgram(GLuint* program);
+// Starts rebuilds for changed sources and swaps in the finished ones without
+// waiting on the driver. Call once per frame on the GL thread.
+void glUtilReloadPrograms();
 
 bool checkScene(Scene* scene);
 } // namespace NextVideo
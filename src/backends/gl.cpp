@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <cstring>
 #include <video.hpp>
 #include <linear.hpp>
@@ -12,11 +15,32 @@
 
 
 #include <glm/ext.hpp>
+#include <stdint.h>
 #include <stdio.h>
+#include <list>
+#ifndef __EMSCRIPTEN__
+#  include <sys/stat.h>
+#endif
+#ifdef __linux__
+#  include <sys/inotify.h>
+#  include <unistd.h>
+#endif
 #define MAX_OBJECTS 512
+#define MAX_SHADOW_CASCADES 4    // Matches u_shadowMats in assets/pbr.fs
+#define LIGHT_INDEX_WIDTH   1024 // Matches assets/lights.glsl
+#define BLOOM_COMPUTE_TILE  8    // Matches local_size in assets/bloom*.cs
+#define GAUSS_MAX_TAPS      16   // Matches assets/gauss.fs
+#define MAX_GRAPH_TEXTURES  16
+#define MAX_GRAPH_PASSES    32
+#define TEXTURE_TAIL_SIZE   64   // Largest side of the levels uploaded up front when streaming
+#define TEXTURE_ARRAY_SIZE  512  // Largest side of the material textures packed into arrays
+
+// Compute paths need GL 4.3 through GLEW and are compiled out elsewhere
+#if defined(GL_COMPUTE_SHADER) && !defined(__EMSCRIPTEN__)
+#  define GL_UTIL_COMPUTE 1
+#endif
 
 namespace NextVideo {
-ENGINE_API const char* readFile(const char* path);
 /* GL_UTIL_FUNCTIONS */
 
 ENGINE_API void glUtilRenderScreenQuad() {
@@ -52,87 +76,422 @@ ENGINE_API void glUtilRenderQuad(GLuint vbo, GLuint ebo, GLuint worldMat, GLuint
   glEnable(GL_CULL_FACE);
 }
 
-ENGINE_API GLuint glUtilLoadProgram(const char* vs, const char* fs) {
+// Splits a source after its #version line so defines and an included file
+// can go in between, the #line directives keep compiler messages pointing at
+// the file lines. The included file is reported as source string 1.
+static int glUtilShaderParts(const FileView& source, const char* defines, const FileView* include, const char** parts, GLint* lengths) {
+  parts[0]   = source.data;
+  lengths[0] = source.size;
+  if (defines == nullptr && include == nullptr) return 1;
+
+  const char* body = source.data;
+  if (source.size >= 8 && strncmp(source.data, "#version", 8) == 0) {
+    body = (const char*)memchr(source.data, '\n', source.size);
+    body = body ? body + 1 : source.end();
+  }
+
+  int count  = 1;
+  lengths[0] = body - source.data;
+  if (defines) {
+    parts[count]     = defines;
+    lengths[count++] = -1;
+  }
+  if (include) {
+    parts[count]     = "\n#line 1 1\n";
+    lengths[count++] = -1;
+    parts[count]     = include->data;
+    lengths[count++] = include->size;
+  }
+  parts[count]     = "\n#line 2 0\n";
+  lengths[count++] = -1;
+  parts[count]     = body;
+  lengths[count++] = source.end() - body;
+  return count;
+}
 
-  char errorBuffer[2048];
+/* Program loading */
+// Programs of a batch are all submitted before any status is queried, so
+// drivers with GL_KHR_parallel_shader_compile, or that compile lazily, build
+// them concurrently. Linked binaries are cached under glUtilProgramCacheDir,
+// keyed by the sources, the defines and the GL vendor, renderer and version
+// strings. A binary the driver rejects is rebuilt from source and replaced.
+#define PROGRAM_CACHE_MAGIC 0x4250564e // "NVPB"
+
+struct GLUtilProgramCacheHeader {
+  unsigned int magic;
+  GLenum       format;
+  GLint        length;
+};
 
-  GLuint VertexShaderID   = glCreateShader(GL_VERTEX_SHADER);
-  GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+static const char* glUtilProgramCacheDir = nullptr;
 
-  GLint Result = GL_FALSE;
-  int   InfoLogLength;
+ENGINE_API void glUtilProgramCache(const char* directory) { glUtilProgramCacheDir = directory; }
 
-  const char* VertexSourcePointer   = readFile(vs);
-  const char* FragmentSourcePointer = readFile(fs);
+static bool glUtilProgramBinarySupported() {
+#ifdef __EMSCRIPTEN__
+  return false;
+#else
+  static int supported = -1;
+  if (supported < 0) {
+    GLint formats = 0;
+    if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary) glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    supported = formats > 0;
+  }
+  return supported;
+#endif
+}
 
-  if (VertexSourcePointer == 0) {
-    ERROR("Error reading vertex shader: %s \n", vs);
-    return -1;
+// FNV-1a, every string is hashed with a terminator so concatenations do not
+// collide
+static uint64_t glUtilHash(uint64_t hash, const char* data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 1099511628211ull;
   }
+  return hash * 1099511628211ull;
+}
+
+static uint64_t glUtilHash(uint64_t hash, const char* data) { return data ? glUtilHash(hash, data, strlen(data)) : glUtilHash(hash, "", 0); }
+
+static void glUtilProgramCachePath(const GLUtilProgramLoad* load, char* path, int size) {
+  snprintf(path, size, "%s/%016llx.bin", glUtilProgramCacheDir, (unsigned long long)load->key);
+}
 
-  if (FragmentSourcePointer == 0) {
-    ERROR("Error reading fragment shader: %s \n", fs);
-    return -1;
+static bool glUtilProgramCacheRead(GLUtilProgramLoad* load) {
+#ifndef __EMSCRIPTEN__
+  char path[1024];
+  glUtilProgramCachePath(load, path, sizeof(path));
+  FILE* file = fopen(path, "rb");
+  if (file == nullptr) return false;
+
+  GLUtilProgramCacheHeader header;
+  std::vector<char>        binary;
+  bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == PROGRAM_CACHE_MAGIC && header.length > 0;
+  if (valid) {
+    binary.resize(header.length);
+    valid = fread(binary.data(), header.length, 1, file) == 1;
   }
+  fclose(file);
+  if (!valid) return false;
+
+  load->program = glCreateProgram();
+  glProgramBinary(load->program, header.format, binary.data(), header.length);
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Written next to its final name and renamed so a crash never leaves a
+// truncated binary behind
+static void glUtilProgramCacheWrite(const GLUtilProgramLoad* load) {
+#ifndef __EMSCRIPTEN__
+  GLUtilProgramCacheHeader header = {PROGRAM_CACHE_MAGIC, 0, 0};
+  glGetProgramiv(load->program, GL_PROGRAM_BINARY_LENGTH, &header.length);
+  if (header.length <= 0) return;
+
+  std::vector<char> binary(header.length);
+  glGetProgramBinary(load->program, header.length, nullptr, &header.format, binary.data());
+
+  char path[1024];
+  char temporary[1040];
+  glUtilProgramCachePath(load, path, sizeof(path));
+  snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+  mkdir(glUtilProgramCacheDir, 0755);
+
+  FILE* file = fopen(temporary, "wb");
+  if (file == nullptr) {
+    ERROR("[RENDERER] Could not write program cache %s\n", temporary);
+    return;
+  }
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(binary.data(), header.length, 1, file) == 1;
+  written      = fclose(file) == 0 && written;
+  if (!written || rename(temporary, path) != 0) {
+    ERROR("[RENDERER] Could not write program cache %s\n", path);
+    remove(temporary);
+  }
+#endif
+}
+
+static void glUtilProgramSubmit(GLUtilProgramLoad* load, bool useCache) {
+  const char* paths[2] = {load->cs ? load->cs : load->vs, load->fs};
+  GLenum      types[2] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER};
+#ifdef GL_UTIL_COMPUTE
+  if (load->cs) types[0] = GL_COMPUTE_SHADER;
+#endif
+  const int stages = load->cs ? 1 : 2;
+
+  FileView sources[2];
+  for (int i = 0; i < stages; i++) {
+    sources[i] = fileView(paths[i]);
+    if (!sources[i] || sources[i].size == 0) {
+      ERROR("Error reading shader: %s \n", paths[i]);
+      load->program = -1;
+      load->failed  = true;
+      return;
+    }
+  }
+
+  // The included file goes into the last stage, the fragment or compute shader
+  FileView include;
+  if (load->include) {
+    include = fileView(load->include);
+    if (!include) {
+      ERROR("Error reading shader: %s \n", load->include);
+      load->program = -1;
+      load->failed  = true;
+      return;
+    }
+  }
+
+  const char* renderer = (const char*)glGetString(GL_RENDERER);
+  uint64_t    key      = glUtilHash(14695981039346656037ull, sources[0].data, sources[0].size);
+  key                  = glUtilHash(key, sources[1].data, sources[1].size);
+  key                  = glUtilHash(key, load->defines);
+  key                  = glUtilHash(key, include.data, include.size);
+  key                  = glUtilHash(key, (const char*)glGetString(GL_VENDOR));
+  key                  = glUtilHash(key, renderer);
+  load->key            = glUtilHash(key, (const char*)glGetString(GL_VERSION));
+  load->failed         = false;
+  load->cached         = useCache && glUtilProgramCacheDir && glUtilProgramBinarySupported() && glUtilProgramCacheRead(load);
+
+  if (!load->cached) {
+    load->program = glCreateProgram();
+    for (int i = 0; i < stages; i++) {
+      const char* parts[6];
+      GLint       lengths[6];
+      int         partCount = glUtilShaderParts(sources[i], load->defines, i == stages - 1 && include ? &include : nullptr, parts, lengths);
+      load->shaders[i]      = glCreateShader(types[i]);
+      glShaderSource(load->shaders[i], partCount, parts, lengths);
+      glCompileShader(load->shaders[i]);
+      glAttachShader(load->program, load->shaders[i]);
+    }
+#ifndef __EMSCRIPTEN__
+    if (glUtilProgramCacheDir && glUtilProgramBinarySupported()) glProgramParameteri(load->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+#endif
+    glLinkProgram(load->program);
+  }
+}
+
+static void glUtilProgramFinish(GLUtilProgramLoad* load) {
+  if (load->failed) return;
+
+  const char* name   = load->cs ? load->cs : load->fs;
+  const int   stages = load->cs ? 1 : 2;
+  char        errorBuffer[2048];
+  GLint       Result = GL_TRUE;
 
-  glShaderSource(VertexShaderID, 1, &VertexSourcePointer, NULL);
-  glCompileShader(VertexShaderID);
+  for (int i = 0; i < stages && !load->cached && Result == GL_TRUE; i++) {
+    glGetShaderiv(load->shaders[i], GL_COMPILE_STATUS, &Result);
+    if (Result != GL_TRUE) {
+      glGetShaderInfoLog(load->shaders[i], sizeof(errorBuffer), NULL, errorBuffer);
+      ERROR("Error loading shader %s : \n%s\n", i == 0 && !load->cs ? load->vs : name, errorBuffer);
+    }
+  }
+  if (Result == GL_TRUE) glGetProgramiv(load->program, GL_LINK_STATUS, &Result);
+
+  if (Result != GL_TRUE && load->cached) {
+    LOG("[RENDERER] Cached binary rejected for %s, rebuilding\n", name);
+    glDeleteProgram(load->program);
+    glUtilProgramSubmit(load, false);
+    glUtilProgramFinish(load);
+    return;
+  }
 
-  // Check Vertex Shader
-  glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-  glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+  if (Result == GL_TRUE && !load->cached && glUtilProgramCacheDir && glUtilProgramBinarySupported()) glUtilProgramCacheWrite(load);
+  if (Result != GL_TRUE && !load->cached) {
+    glGetProgramInfoLog(load->program, sizeof(errorBuffer), NULL, errorBuffer);
+    ERROR("Error compiling program %s : \n%s\n", name, errorBuffer);
+  }
 
-  if (InfoLogLength > 0) {
-    glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, errorBuffer);
-    ERROR("Error loading vertex shader Source : %s : \nError : %s\n", vs, errorBuffer);
-    free((void*)VertexSourcePointer);
-    free((void*)FragmentSourcePointer);
-    return 0;
+  for (int i = 0; i < stages && !load->cached; i++) {
+    glDetachShader(load->program, load->shaders[i]);
+    glDeleteShader(load->shaders[i]);
+  }
+  if (Result != GL_TRUE) {
+    glDeleteProgram(load->program);
+    load->program = 0;
+    load->failed  = true;
+    return;
   }
+  LOG("[RENDERER] Program %s successfully %s\n", load->cached ? "restored" : "loaded", name);
+}
+
+ENGINE_API void glUtilLoadPrograms(GLUtilProgramLoad* loads, int count) {
+#ifndef __EMSCRIPTEN__
+  static bool threads = false;
+  if (!threads && GLEW_KHR_parallel_shader_compile) glMaxShaderCompilerThreadsKHR(0xffffffff);
+  else if (!threads && GLEW_ARB_parallel_shader_compile) glMaxShaderCompilerThreadsARB(0xffffffff);
+  threads = true;
+#endif
+  for (int i = 0; i < count; i++) glUtilProgramSubmit(&loads[i], true);
+  for (int i = 0; i < count; i++) glUtilProgramFinish(&loads[i]);
+}
+
+ENGINE_API GLuint glUtilLoadProgram(const char* vs, const char* fs, const char* defines) {
+  GLUtilProgramLoad load;
+  load.vs      = vs;
+  load.fs      = fs;
+  load.defines = defines;
+  glUtilLoadPrograms(&load, 1);
+  return load.program;
+}
+
+#ifdef GL_UTIL_COMPUTE
+ENGINE_API GLuint glUtilLoadComputeProgram(const char* cs, const char* defines) {
+  GLUtilProgramLoad load;
+  load.cs      = cs;
+  load.defines = defines;
+  glUtilLoadPrograms(&load, 1);
+  return load.failed ? 0 : load.program;
+}
+#endif
+
+/* Program reloading */
+// inotify watches the directories holding the sources rather than the files,
+// editors that save by renaming over the old file would otherwise drop the
+// watch. A rebuild is submitted on the frame its change is seen and finished
+// only once the driver reports it complete, so with
+// GL_KHR_parallel_shader_compile the compile never stalls a frame. Without it
+// the driver decides whether the finishing query waits.
+struct GLUtilProgramWatch {
+  GLuint*               program;
+  std::string           sources[4]; // vs, fs, cs, include as given, empty when unused
+  std::string           paths[4];   // Same files as directory/name to match events
+  std::string           defines;
+  bool                  hasDefines;
+  std::function<void()> reloaded;
+  GLUtilProgramLoad     pending;
+  bool                  building = false;
+  bool                  stale    = false; // Changed again while building
+};
 
-  glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer, NULL);
-  glCompileShader(FragmentShaderID);
+static std::list<GLUtilProgramWatch> glUtilWatches;
+#ifdef __linux__
+static int                                       glUtilWatchFd = -1;
+static std::vector<std::pair<int, std::string>> glUtilWatchDirs;
+#endif
 
-  // Check Fragment Shader
-  glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-  glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+static std::string glUtilWatchPath(const char* path) {
+  const char* slash = strrchr(path, '/');
+  return slash ? std::string(path) : std::string("./") + path;
+}
 
-  if (InfoLogLength > 0) {
-    glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, errorBuffer);
-    ERROR("Error loading fragment shader %s : \n%s\n", fs, errorBuffer);
-    free((void*)VertexSourcePointer);
-    free((void*)FragmentSourcePointer);
-    return 0;
+static bool glUtilProgramReady(const GLUtilProgramLoad* load) {
+#ifndef __EMSCRIPTEN__
+  if (!load->failed && (GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile)) {
+    GLint complete = GL_TRUE;
+    glGetProgramiv(load->program, GL_COMPLETION_STATUS_KHR, &complete);
+    return complete == GL_TRUE;
   }
+#endif
+  return true;
+}
 
-  GLuint ProgramID = glCreateProgram();
-  glAttachShader(ProgramID, VertexShaderID);
-  glAttachShader(ProgramID, FragmentShaderID);
-  glLinkProgram(ProgramID);
+ENGINE_API void glUtilWatchProgram(GLuint* program, const GLUtilProgramLoad& load, std::function<void()> reloaded) {
+#ifdef __linux__
+  if (glUtilWatchFd < 0) glUtilWatchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (glUtilWatchFd < 0) {
+    ERROR("[RENDERER] Could not start watching shader sources\n");
+    return;
+  }
 
-  // Check the program
-  glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-  glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+  glUtilUnwatchProgram(program);
+  GLUtilProgramWatch& watch = glUtilWatches.emplace_back();
+  const char*         given[4] = {load.vs, load.fs, load.cs, load.include};
+  watch.program                = program;
+  watch.hasDefines             = load.defines != nullptr;
+  watch.defines                = load.defines ? load.defines : "";
+  watch.reloaded               = reloaded;
+
+  for (int i = 0; i < 4; i++) {
+    if (given[i] == nullptr) continue;
+    watch.sources[i] = given[i];
+    watch.paths[i]   = glUtilWatchPath(given[i]);
+
+    std::string directory = watch.paths[i].substr(0, watch.paths[i].rfind('/'));
+    int         wd        = inotify_add_watch(glUtilWatchFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0) {
+      ERROR("[RENDERER] Could not watch %s\n", directory.c_str());
+      continue;
+    }
+    bool known = false;
+    for (auto& dir : glUtilWatchDirs) known = known || dir.first == wd;
+    if (!known) glUtilWatchDirs.push_back({wd, directory});
+  }
+#endif
+}
 
-  if (InfoLogLength > 0) {
-    glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, errorBuffer);
-    ERROR("Error compiling program %s : \n%s\n", fs, errorBuffer);
-    free((void*)VertexSourcePointer);
-    free((void*)FragmentSourcePointer);
-    return 0;
+ENGINE_API void glUtilUnwatchProgram(GLuint* program) {
+  for (auto it = glUtilWatches.begin(); it != glUtilWatches.end();) {
+    if (it->program != program) {
+      ++it;
+      continue;
+    }
+    if (it->building) {
+      glUtilProgramFinish(&it->pending);
+      if (!it->pending.failed) glDeleteProgram(it->pending.program);
+    }
+    it = glUtilWatches.erase(it);
   }
+}
 
-  glDetachShader(ProgramID, VertexShaderID);
-  glDetachShader(ProgramID, FragmentShaderID);
+ENGINE_API void glUtilReloadPrograms() {
+#ifdef __linux__
+  if (glUtilWatchFd < 0 || glUtilWatches.empty()) return;
+
+  std::vector<std::string> changed;
+  alignas(struct inotify_event) char buffer[4096];
+  ssize_t                            size;
+  while ((size = read(glUtilWatchFd, buffer, sizeof(buffer))) > 0) {
+    for (char* p = buffer; p < buffer + size;) {
+      const struct inotify_event* event = (const struct inotify_event*)p;
+      p += sizeof(struct inotify_event) + event->len;
+      if (event->len == 0) continue;
+      for (auto& dir : glUtilWatchDirs) {
+        if (dir.first == event->wd) changed.push_back(dir.second + "/" + event->name);
+      }
+    }
+  }
 
-  glDeleteShader(VertexShaderID);
-  glDeleteShader(FragmentShaderID);
+  for (GLUtilProgramWatch& watch : glUtilWatches) {
+    bool dirty = watch.stale;
+    for (const std::string& path : changed) {
+      for (const std::string& source : watch.paths) dirty = dirty || (!source.empty() && path == source);
+    }
+    if (!dirty) continue;
+    if (watch.building) {
+      watch.stale = true;
+      continue;
+    }
 
-  free((void*)VertexSourcePointer);
-  free((void*)FragmentSourcePointer);
+    watch.pending         = GLUtilProgramLoad();
+    watch.pending.vs      = watch.sources[0].empty() ? nullptr : watch.sources[0].c_str();
+    watch.pending.fs      = watch.sources[1].empty() ? nullptr : watch.sources[1].c_str();
+    watch.pending.cs      = watch.sources[2].empty() ? nullptr : watch.sources[2].c_str();
+    watch.pending.include = watch.sources[3].empty() ? nullptr : watch.sources[3].c_str();
+    watch.pending.defines = watch.hasDefines ? watch.defines.c_str() : nullptr;
+    watch.stale           = false;
+    watch.building        = true;
+    LOG("[RENDERER] Rebuilding %s\n", watch.pending.cs ? watch.pending.cs : watch.pending.fs);
+    glUtilProgramSubmit(&watch.pending, true);
+  }
 
-  LOG("[RENDERER] Program loaded successfully %s\n", fs);
-  return ProgramID;
+  for (GLUtilProgramWatch& watch : glUtilWatches) {
+    if (!watch.building || !glUtilProgramReady(&watch.pending)) continue;
+    watch.building = false;
+    glUtilProgramFinish(&watch.pending);
+
+    const char* name = watch.pending.cs ? watch.pending.cs : watch.pending.fs;
+    if (watch.pending.failed) {
+      ERROR("[RENDERER] Keeping the last good program for %s\n", name);
+      continue;
+    }
+    glDeleteProgram(*watch.program);
+    *watch.program = watch.pending.program;
+    if (watch.reloaded) watch.reloaded();
+  }
+#endif
 }
 
 bool checkScene(Scene* scene) {
@@ -152,59 +511,146 @@ const inline static unsigned int attachments[] = {
 
 /* Renderer begin */
 /* Engine Default Variables */
-static int PARAM_BLOOM_CHAIN_LENGTH = 8;
+#define PARAM_BLOOM_CHAIN_LENGTH_MAX 8
+static int PARAM_BLOOM_CHAIN_LENGTH = PARAM_BLOOM_CHAIN_LENGTH_MAX;
 
 static int BUFF_START_USER       = 0;
 static int BUFF_PLAIN            = 0;
 static int TEXT_STD              = 0;
 static int TEXT_IBL              = 1;
-static int TEXT_ATTACHMENT_COLOR = 2;
-static int TEXT_ATTACHMENT_BLOOM = 3;
-static int TEXT_GAUSS_RESULT0    = 4;
-static int TEXT_GAUSS_RESULT02   = 5;
-static int TEXT_GAUSS_RESULT1    = 6;
-static int TEXT_GAUSS_RESULT12   = 7;
-static int TEXT_GAUSS_RESULT2    = 8;
-static int TEXT_GAUSS_RESULT22   = 9;
-static int TEXT_GAUSS_RESULT3    = 10;
-static int TEXT_GAUSS_RESULT32   = 11;
-static int TEXT_BLOOM_START      = 12;
-static int TEXT_BLOOM_END        = TEXT_BLOOM_START + PARAM_BLOOM_CHAIN_LENGTH;
-static int TEXT_SHADOW_MAP       = TEXT_BLOOM_END + 1;
-static int TEXT_END              = TEXT_SHADOW_MAP;
+static int TEXT_GRAPH_START      = 2;
+static int TEXT_GRAPH_END        = TEXT_GRAPH_START + MAX_GRAPH_TEXTURES;
+static int TEXT_SHADOW_MAP       = TEXT_GRAPH_END;
+static int TEXT_GBUFFER_ALBEDO   = TEXT_SHADOW_MAP + 1;
+static int TEXT_GBUFFER_NORMAL   = TEXT_SHADOW_MAP + 2;
+static int TEXT_GBUFFER_DEPTH    = TEXT_SHADOW_MAP + 3;
+static int TEXT_LIGHTS           = TEXT_SHADOW_MAP + 4;
+static int TEXT_LIGHT_TILES      = TEXT_SHADOW_MAP + 5;
+static int TEXT_LIGHT_INDICES    = TEXT_SHADOW_MAP + 6;
+static int TEXT_MATERIAL_ARRAY   = TEXT_SHADOW_MAP + 7;
+static int TEXT_END              = TEXT_MATERIAL_ARRAY;
 static int TEXT_START_USER       = TEXT_END + 1;
-static int FBO_HDR_PASS          = 0;
-static int FBO_GAUSS_PASS_PING   = 1;
-static int FBO_GAUSS_PASS_PONG   = 2;
-static int FBO_BLOOM             = 3;
-static int FBO_SHADOW_MAP        = 4;
-static int FBO_START_USER        = 5;
-static int RBO_HDR_PASS_DEPTH    = 0;
-
-#define UNIFORMLIST_HDR(o, u)        o(u_color, u) o(u_bloom, u)
-#define UNIFORMLIST_GAUSS(o, u)      o(u_input, u) o(u_horizontal, u)
+static int FBO_SHADOW_MAP        = 0;
+static int FBO_GBUFFER           = 1;
+static int FBO_GRAPH_START       = 2;
+static int FBO_GRAPH_END         = FBO_GRAPH_START + MAX_GRAPH_PASSES;
+static int FBO_START_USER        = FBO_GRAPH_END;
+
+// Indexed by RenderGraphFormat
+static const struct {
+  GLenum internalFormat;
+  GLenum format;
+  GLenum type;
+} GRAPH_FORMATS[] = {
+  {GL_RGB16F, GL_RGB, GL_FLOAT},
+  {GL_R11F_G11F_B10F, GL_RGB, GL_FLOAT},
+  {GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE},
+  {GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8}};
+
+#define UNIFORMLIST_HDR(o, u)        o(u_color, u) o(u_bloom, u) o(u_bloomStrength, u)
+#define UNIFORMLIST_GAUSS(o, u)      o(u_input, u) o(u_direction, u) o(u_taps, u) o(u_weights, u) o(u_offsets, u)
 #define UNIFORMLIST_UPSAMPLE(o, u)   o(srcTexture, u) o(filterRadius, u)
 #define UNIFORMLIST_DOWNSAMPLE(o, u) o(srcTexture, u) o(srcResolution, u)
+#define UNIFORMLIST_DEPTH(o, u)      o(u_ViewMat, u) o(u_ProjMat, u) o(u_WorldMat, u)
+
+#define UNIFORMLIST_GBUFFER(o, u)                                                         \
+  o(u_ViewMat, u) o(u_ProjMat, u) o(u_WorldMat, u) o(u_flatUV, u) o(u_uvScale, u)         \
+    o(u_uvOffset, u) o(u_kd, u) o(u_ks, u) o(u_useTextures, u) o(u_diffuseTexture, u)     \
+      o(u_diffuseArray, u) o(u_diffuseLayer, u)
+
+#define UNIFORMLIST_CLUSTER(o, u)                                                           \
+  o(u_lights, u) o(u_lightTiles, u) o(u_lightIndices, u) o(u_viewOrigin, u) o(u_tileSize, u) \
+    o(u_tilesY, u) o(u_clusterSlices, u) o(u_clusterScale, u) o(u_clusterBias, u)            \
+      o(u_lightGlobals, u)
+
+#define UNIFORMLIST_DEFERRED(o, u)                                                          \
+  o(u_albedo, u) o(u_normal, u) o(u_depth, u) o(u_envMap, u) o(u_invViewProj, u)            \
+    o(u_ViewMat, u) o(u_ro, u) o(u_shadowMap, u) o(u_shadowMats, u) o(u_shadowSplits, u)    \
+      o(u_shadowCascades, u) UNIFORMLIST_CLUSTER(o, u)
 
 #define UNIFORMLIST_PBR(o, u)                                                               \
   o(u_envMap, u) o(u_diffuseTexture, u) o(u_specularTexture, u) o(u_bumpTexture, u)         \
     o(u_kd, u) o(u_ka, u) o(u_ks, u) o(u_shinnness, u) o(u_ro, u) o(u_rd, u) o(u_isBack, u) \
       o(u_shadingMode, u) o(u_useTextures, u) o(u_ViewMat, u) o(u_ProjMat, u)               \
-        o(u_WorldMat, u) o(u_flatUV, u) o(u_uvScale, u) o(u_uvOffset, u)
+        o(u_WorldMat, u) o(u_flatUV, u) o(u_uvScale, u) o(u_uvOffset, u)                    \
+          o(u_shadowMap, u) o(u_shadowMats, u) o(u_shadowSplits, u) o(u_shadowCascades, u)  \
+            o(u_clustered, u) o(u_diffuseArray, u) o(u_diffuseLayer, u)                     \
+              UNIFORMLIST_CLUSTER(o, u)
 
 #define UNIFORMLIST(o)                         \
   UNIFORMLIST_HDR(o, hdr)                      \
   UNIFORMLIST_GAUSS(o, filter_gauss)           \
   UNIFORMLIST_UPSAMPLE(o, filter_upsample)     \
   UNIFORMLIST_DOWNSAMPLE(o, filter_downsample) \
+  UNIFORMLIST_DEPTH(o, depth)                  \
+  UNIFORMLIST_GBUFFER(o, gbuffer)              \
+  UNIFORMLIST_DEFERRED(o, deferred)            \
   UNIFORMLIST_PBR(o, pbr)
 
-#define PROGRAMLIST(O)                                             \
-  O(hdr, "assets/filter.vs", "assets/hdr.fs")                      \
-  O(filter_gauss, "assets/filter.vs", "assets/gauss.fs")           \
-  O(filter_upsample, "assets/filter.vs", "assets/upsample.fs")     \
-  O(filter_downsample, "assets/filter.vs", "assets/downsample.fs") \
-  O(pbr, "assets/pbr.vs", "assets/pbr.fs")
+// Compute programs, only loaded when the context supports them
+#define UNIFORMLIST_COMPUTE(o)                                                                  \
+  o(u_src, bloom_downsample) o(u_src, bloom_upsample) o(u_filterRadius, bloom_upsample)         \
+    o(u_color, bloom_composite) o(u_bloom, bloom_composite) o(u_bloomNext, bloom_composite)     \
+      o(u_filterRadius, bloom_composite) o(u_bloomLevels, bloom_composite)                      \
+        o(u_bloomStrength, bloom_composite)
+
+#define COMPUTELIST(O)                                  \
+  O(bloom_downsample, "assets/bloomDownsample.cs")      \
+  O(bloom_upsample, "assets/bloomUpsample.cs")          \
+  O(bloom_composite, "assets/bloomComposite.cs")
+
+#define PROGRAMLIST(O)                                                        \
+  O(hdr, "assets/filter.vs", "assets/hdr.fs", nullptr)                        \
+  O(filter_gauss, "assets/filter.vs", "assets/gauss.fs", nullptr)             \
+  O(filter_upsample, "assets/filter.vs", "assets/upsample.fs", nullptr)       \
+  O(filter_downsample, "assets/filter.vs", "assets/downsample.fs", nullptr)   \
+  O(depth, "assets/depth.vs", "assets/depth.fs", nullptr)                     \
+  O(gbuffer, "assets/pbr.vs", "assets/gbuffer.fs", nullptr)                   \
+  O(deferred, "assets/filter.vs", "assets/deferred.fs", "assets/lights.glsl") \
+  O(pbr, "assets/pbr.vs", "assets/pbr.fs", "assets/lights.glsl")
+
+// Discrete Gaussian over [-radius, radius] with sigma radius / 3, the radius
+// capped by the tap count. Neighbouring taps are merged into one bilinear
+// fetch at their weighted offset, tap 0 is the center and the shader mirrors
+// the rest. Returns the tap count.
+static int gaussKernel(float radius, float* weights, float* offsets) {
+  const int   r     = std::min(std::max(int(std::ceil(radius)), 1), 2 * (GAUSS_MAX_TAPS - 1));
+  const float sigma = std::max(std::min(radius, float(r)) / 3.0f, 0.5f);
+  float       w[2 * GAUSS_MAX_TAPS];
+  float       sum = 0.0f;
+  for (int i = 0; i <= r; i++) {
+    w[i] = std::exp(-0.5f * i * i / (sigma * sigma));
+    sum += i == 0 ? w[i] : 2.0f * w[i];
+  }
+
+  int taps   = 1;
+  weights[0] = w[0] / sum;
+  offsets[0] = 0.0f;
+  for (int i = 1; i <= r; i += 2, taps++) {
+    float a       = w[i];
+    float b       = i + 1 <= r ? w[i + 1] : 0.0f;
+    weights[taps] = (a + b) / sum;
+    offsets[taps] = (i * a + (i + 1) * b) / (a + b);
+  }
+  return taps;
+}
+
+// Next level of an RGB8 mip chain, each texel the average of the 2x2 block
+// it covers. The last row or column is repeated on odd sizes.
+static void textureDownsample(const unsigned char* src, int width, int height, std::vector<unsigned char>* dst) {
+  const int w = std::max(width / 2, 1);
+  const int h = std::max(height / 2, 1);
+  dst->resize(w * h * 3);
+  for (int y = 0; y < h; y++) {
+    const unsigned char* row0 = src + std::min(2 * y, height - 1) * width * 3;
+    const unsigned char* row1 = src + std::min(2 * y + 1, height - 1) * width * 3;
+    for (int x = 0; x < w; x++) {
+      const int x0 = std::min(2 * x, width - 1) * 3;
+      const int x1 = std::min(2 * x + 1, width - 1) * 3;
+      for (int c = 0; c < 3; c++) (*dst)[(y * w + x) * 3 + c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4;
+    }
+  }
+}
 
 struct Renderer : public IRenderer {
 
@@ -220,14 +666,136 @@ struct Renderer : public IRenderer {
 
   /* Default programs */
 
-#define PROGRAM_DECL(o, vs, fs) GLuint program_##o;
+#define PROGRAM_DECL(o, vs, fs, include) GLuint program_##o;
   PROGRAMLIST(PROGRAM_DECL)
 #undef PROGRAM_DECL
 
+#define COMPUTE_DECL(o, cs) GLuint program_##o = 0;
+  COMPUTELIST(COMPUTE_DECL)
+#undef COMPUTE_DECL
+
 #define UNIFORM_DECL(o, u) GLuint u##_##o;
   UNIFORMLIST(UNIFORM_DECL)
+  UNIFORMLIST_COMPUTE(UNIFORM_DECL)
 #undef UNIFORM_DECL
 
+  bool computeSupported = false;
+
+  /* Culling */
+  // Local bounds per mesh are taken at upload. World bounds of every instance
+  // are built once per frame and shared by all the views rendered in it.
+  std::vector<lin::AABB>     meshBounds;
+  std::vector<lin::AABB>     instanceBounds;
+  std::vector<int>           groupFirst;
+  std::vector<unsigned char> instanceVisible;
+
+  /* Material texture arrays */
+  // Albedo textures of at most TEXTURE_ARRAY_SIZE a side are packed at upload
+  // as layers of one GL_TEXTURE_2D_ARRAY per size and sampling mode, so
+  // materials sharing an array only differ in the layer uniform and the
+  // number of textures is no longer bound by the texture units.
+  // texturePacking[i] is the array and layer of scene texture i, x is -1 for
+  // textures kept as their own 2D texture.
+  std::vector<GLuint>     textureArrays;
+  std::vector<glm::ivec2> texturePacking;
+  int                     boundArray = -1;
+
+  /* Texture residency */
+  // With texture_stream_enable upload() only sends the mip tail, the levels
+  // of at most TEXTURE_TAIL_SIZE texels a side, and keeps the rest of the
+  // chain on the CPU. Each view estimates the level its draws need from the
+  // screen size of their bounds, and after the frame the wanted levels are
+  // uploaded coarse to fine. GL_TEXTURE_BASE_LEVEL is the finest resident
+  // level; levels dropped to fit the budget are redefined empty so the driver
+  // can release them.
+  struct TextureResidency {
+    std::vector<std::vector<unsigned char>> levels; // From level 1, level 0 is Texture::data
+    const unsigned char*                    source   = nullptr;
+    glm::ivec2                              size     = glm::ivec2(0);
+    int                                     count    = 0; // 0 when the texture is not streamed
+    int                                     tail     = 0; // Coarsest levels, always resident
+    int                                     resident = 0;
+    int                                     wanted   = 0; // Finest level any view wanted this frame
+    uint64_t                                lastUse  = 0; // Last frame that wanted the finest resident level
+  };
+  std::vector<TextureResidency> residency;
+  size_t                        residentBytes  = 0;
+  uint64_t                      residencyFrame = 0;
+
+  /* Shadows */
+  // Cascades of the first directional light, fit to the main camera every
+  // frame. The map is only reallocated when its settings change.
+  Camera    shadowCameras[MAX_SHADOW_CASCADES];
+  glm::mat4 shadowMats[MAX_SHADOW_CASCADES];
+  float     shadowSplits[MAX_SHADOW_CASCADES] = {};
+  int       shadowCascades = 0;
+  int       shadowWidth    = 0;
+  int       shadowHeight   = 0;
+  int       shadowLayers   = 0;
+
+  /* Render graph */
+  // HDR and post processing of render(), rebuilt and realized only when the
+  // surface size or the settings it was built from change. Passes read the
+  // frame being rendered from the graph* fields.
+  RenderGraph  graph;
+  RendererDesc graphDesc;
+  glm::ivec2   graphSize      = glm::ivec2(0);
+  Scene*       graphScene     = nullptr;
+  const View*  graphViews     = nullptr;
+  int          graphViewCount = 0;
+
+  /* Draw list */
+  // Visible instances of the last culled camera in submission order
+  struct DrawItem {
+    float groupDepth;
+    float depth;
+    int   group;
+    int   instance;
+  };
+  std::vector<DrawItem> drawList;
+
+  // Locations of the uniforms every program drawing scene geometry has
+  struct SurfaceUniforms {
+    GLuint viewMat;
+    GLuint projMat;
+    GLuint worldMat;
+    GLuint flatUV;
+    GLuint uvScale;
+    GLuint uvOffset;
+    GLuint kd;
+    GLuint ks;
+    GLuint useTextures;
+    GLuint diffuseTexture;
+    GLuint diffuseLayer;
+  };
+  SurfaceUniforms surfacePbr;
+  SurfaceUniforms surfaceGbuffer;
+
+  /* Lights */
+  // Lights are uploaded once per frame and binned into the cluster grid once
+  // per view, for the deferred pass or the clustered forward pass
+  struct ClusterUniforms {
+    GLuint viewOrigin;
+    GLuint tileSize;
+    GLuint tilesY;
+    GLuint slices;
+    GLuint scale;
+    GLuint bias;
+    GLuint globals;
+  };
+  ClusterUniforms clusterPbr;
+  ClusterUniforms clusterDeferred;
+
+  /* Deferred */
+  // G-buffer sized to the surface
+  LightGrid          lightGrid;
+  std::vector<float> lightData;
+  glm::ivec2         lightsCapacity       = glm::ivec2(0);
+  glm::ivec2         lightTilesCapacity   = glm::ivec2(0);
+  glm::ivec2         lightIndicesCapacity = glm::ivec2(0);
+  int                gbufferWidth         = 0;
+  int                gbufferHeight        = 0;
+
   /* Debug checks */
 
   int bindTexture(int textureSlot) {
@@ -236,44 +804,19 @@ struct Renderer : public IRenderer {
     return textureSlot;
   }
 
-  ENGINE_API void glUtilAttachScreenTexture(int textureSlot, int attachment, GLenum type, GLenum format) {
-
-    if (desc.surface->resized()) {
-
-      int width  = desc.surface->getWidth();
-      int height = desc.surface->getHeight();
-      VERIFY(width > 0, "Width not valid!\n");
-      VERIFY(width > 0, "Height not valid!\n");
-      glActiveTexture(GL_TEXTURE0 + textureSlot);
-      glBindTexture(GL_TEXTURE_2D, textures[textureSlot]);
-      glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, type, GL_UNSIGNED_BYTE, NULL);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-      glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, textures[textureSlot], 0);
-      LOG("[RENDERER] Generated screen texture for %d to attachment %d -> %d for size %dx%d\n", textureSlot, attachment, textures[textureSlot], width, height);
-      glActiveTexture(GL_TEXTURE0);
-    }
-  }
-
-  ENGINE_API void glUtilAttachRenderBuffer(int rbo, int attachment, GLenum type) {
-    if (desc.surface->resized()) {
-
-      int width  = desc.surface->getWidth();
-      int height = desc.surface->getHeight();
-      VERIFY(width > 0, "Width not valid!\n");
-      VERIFY(width > 0, "Height not valid!\n");
-      glBindRenderbuffer(GL_RENDERBUFFER, rbos[rbo]);
-      glRenderbufferStorage(GL_RENDERBUFFER, type, width, height);
-      glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachment, GL_RENDERBUFFER, rbos[rbo]);
-      LOG("[RENDERER] Generated render buffer for %d attachment %d\n for size %dx%d\n", rbo, attachment, width, height);
+  ENGINE_API void upload(Scene* scene) override {
+    //Texture packing
+    {
+      packTextures(scene);
     }
-  }
 
-  ENGINE_API void upload(Scene* scene) override {
     //Texture loading
     {
       const Texture* textureTable = scene->textures.data();
+      residency.assign(scene->textures.size(), TextureResidency());
+      residentBytes = 0;
       for (int i = 0; i < scene->textures.size(); i++) {
+        if (texturePacking[i].x >= 0) continue;
         glActiveTexture(GL_TEXTURE0 + i + TEXT_START_USER);
         glBindTexture(GL_TEXTURE_2D, textures[i + TEXT_START_USER]);
         if (textureTable[i].useNearest) {
@@ -290,6 +833,10 @@ struct Renderer : public IRenderer {
 
 
         LOG("[RENDERER] Uploading texture [%d] width %d height %d channels %d\n", i, textureTable[i].width, textureTable[i].height, textureTable[i].channels);
+        if (!textureTable[i].mipmapDisable && _desc.texture_mipmap_enable && _desc.texture_stream_enable) {
+          residencyInit(i, textureTable[i]);
+          continue;
+        }
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, textureTable[i].width, textureTable[i].height, 0, GL_RGB, GL_UNSIGNED_BYTE, textureTable[i].data);
         if (!textureTable[i].mipmapDisable && _desc.texture_mipmap_enable)
           glGenerateMipmap(GL_TEXTURE_2D);
@@ -316,13 +863,42 @@ struct Renderer : public IRenderer {
         }
       }
     }
+
+    //Mesh bounds
+    {
+      meshBounds.resize(scene->meshes.size());
+      for (int i = 0; i < scene->meshes.size(); i++) {
+        Mesh*      mesh   = &scene->meshes[i];
+        lin::AABB& bounds = meshBounds[i];
+        bounds.min        = glm::vec3(0.0f);
+        bounds.max        = glm::vec3(0.0f);
+        if (mesh->type != CUSTOM || mesh->tCustom.numVertices <= 0) continue;
+
+        // Position is the first attribute of every mesh format
+        const int    stride = MESH_FORMAT_SIZE[mesh->tCustom.meshFormat];
+        const float* vertex = mesh->tCustom.vertexBuffer;
+        bounds.min = bounds.max = glm::vec3(vertex[0], vertex[1], vertex[2]);
+        for (int v = 1; v < mesh->tCustom.numVertices; v++) {
+          glm::vec3 p(vertex[v * stride], vertex[v * stride + 1], vertex[v * stride + 2]);
+          bounds.min = glm::min(bounds.min, p);
+          bounds.max = glm::max(bounds.max, p);
+        }
+      }
+    }
     LOG("[Renderer] Render upload completed.\n");
   }
 
   ~Renderer() {
 
     Renderer* renderer = this;
+#define PROGRAM_UNWATCH(name, ...) glUtilUnwatchProgram(&renderer->program_##name);
+    PROGRAMLIST(PROGRAM_UNWATCH);
+#ifdef GL_UTIL_COMPUTE
+    COMPUTELIST(PROGRAM_UNWATCH);
+#endif
+#undef PROGRAM_UNWATCH
     glDeleteTextures(renderer->textures.size(), renderer->textures.data());
+    glDeleteTextures(renderer->textureArrays.size(), renderer->textureArrays.data());
     glDeleteBuffers(renderer->vbos.size(), renderer->vbos.data());
     glDeleteBuffers(renderer->ebos.size(), renderer->ebos.data());
     glDeleteFramebuffers(renderer->fbos.size(), renderer->fbos.data());
@@ -331,25 +907,220 @@ struct Renderer : public IRenderer {
     LOG("[Renderer] Render destroy completed.\n");
   }
 
-  ENGINE_API void bindMaterial(Renderer* renderer, Material* mat) {
+  // Groups the textures only sampled as material albedo by size and sampling
+  // mode, groups of one stay 2D textures
+  ENGINE_API void packTextures(Scene* scene) {
+    const Texture*    table = scene->textures.data();
+    std::vector<char> packable(scene->textures.size(), 0);
+    for (const Material& mat : scene->materials) {
+      if (valid(scene->textures, mat.albedoTexture)) packable[mat.albedoTexture] = 1;
+    }
+    for (const Stage& stage : scene->stages) {
+      if (valid(scene->textures, stage.skyTexture)) packable[stage.skyTexture] = 0;
+    }
+
+    glDeleteTextures(textureArrays.size(), textureArrays.data());
+    textureArrays.clear();
+    texturePacking.assign(scene->textures.size(), glm::ivec2(-1, 0));
+    boundArray = -1;
+
+    auto mipmapped = [&](const Texture& t) { return !t.mipmapDisable && _desc.texture_mipmap_enable; };
+    std::vector<std::vector<int>> groups;
+    for (int i = 0; i < scene->textures.size(); i++) {
+      const Texture& t = table[i];
+      if (!packable[i] || std::max(t.width, t.height) > TEXTURE_ARRAY_SIZE) continue;
+      auto group = std::find_if(groups.begin(), groups.end(), [&](const std::vector<int>& g) {
+        const Texture& o = table[g[0]];
+        return o.width == t.width && o.height == t.height && o.useNearest == t.useNearest && mipmapped(o) == mipmapped(t);
+      });
+      if (group == groups.end()) groups.push_back({i});
+      else group->push_back(i);
+    }
+
+    glActiveTexture(GL_TEXTURE0 + TEXT_MATERIAL_ARRAY);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (const std::vector<int>& group : groups) {
+      if (group.size() < 2) continue;
+      const Texture& first = table[group[0]];
+      GLuint         array;
+      glGenTextures(1, &array);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+      glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB, first.width, first.height, group.size(), 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+      for (int layer = 0; layer < group.size(); layer++) {
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, first.width, first.height, 1, GL_RGB, GL_UNSIGNED_BYTE, table[group[layer]].data);
+        texturePacking[group[layer]] = glm::ivec2(textureArrays.size(), layer);
+      }
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, first.useNearest ? GL_NEAREST : GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, mipmapped(first) ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+      if (mipmapped(first)) glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+      LOG("[RENDERER] Packed %d textures of %d x %d into array %d\n", (int)group.size(), first.width, first.height, (int)textureArrays.size());
+      textureArrays.push_back(array);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  glm::ivec2 residencySize(const TextureResidency& r, int level) { return glm::max(glm::ivec2(r.size.x >> level, r.size.y >> level), glm::ivec2(1)); }
+
+  // Drivers keep RGB8 as four bytes per texel
+  size_t residencyBytes(const TextureResidency& r, int level) {
+    glm::ivec2 size = residencySize(r, level);
+    return size_t(size.x) * size.y * 4;
+  }
+
+  // Expects texture unit texture + TEXT_START_USER bound and an unpack
+  // alignment of 1, rows of the small levels are not 4 byte multiples
+  void residencyUpload(int texture, int level) {
+    TextureResidency&    r    = residency[texture];
+    glm::ivec2           size = residencySize(r, level);
+    const unsigned char* data = level == 0 ? r.source : r.levels[level - 1].data();
+    glTexImage2D(GL_TEXTURE_2D, level, GL_RGB, size.x, size.y, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+    residentBytes += residencyBytes(r, level);
+  }
+
+  void residencyInit(int texture, const Texture& tex) {
+    TextureResidency& r = residency[texture];
+    r.source            = (const unsigned char*)tex.data;
+    r.size              = glm::ivec2(tex.width, tex.height);
+    r.count             = 1;
+    while (std::max(r.size.x, r.size.y) >> r.count) r.count++;
+
+    r.levels.resize(r.count - 1);
+    for (int level = 1; level < r.count; level++) {
+      glm::ivec2 size = residencySize(r, level - 1);
+      textureDownsample(level == 1 ? r.source : r.levels[level - 2].data(), size.x, size.y, &r.levels[level - 1]);
+    }
+
+    r.tail = 0;
+    while (r.tail < r.count - 1 && std::max(residencySize(r, r.tail).x, residencySize(r, r.tail).y) > TEXTURE_TAIL_SIZE) r.tail++;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int level = r.count - 1; level >= r.tail; level--) residencyUpload(texture, level);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, r.tail);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, r.count - 1);
+    r.resident = r.wanted = r.tail;
+  }
+
+  // The sky covers the screen and is sampled by direction, it always wants
+  // its finest level
+  ENGINE_API void residencyBegin(Stage* stage) {
+    residencyFrame++;
+    for (TextureResidency& r : residency) r.wanted = r.count - 1;
+    if (valid(residency, stage->skyTexture)) residency[stage->skyTexture].wanted = 0;
+  }
+
+  // Finest level the draw list of a view needs: an instance covers about the
+  // projected diagonal of its bounds in pixels, and its material texture is
+  // assumed to span it uvScale times
+  ENGINE_API void residencyMeasure(Scene* scene, Stage* stage, const View& view) {
+    if (residency.empty()) return;
+    const Camera& camera = view.camera;
+    const float   scale  = camera.proj[1][1] * view.height * 0.5f;
+    for (const DrawItem& item : drawList) {
+      const Material& mat = scene->materials[stage->objects[stage->instances[item.group].object].material];
+      if (!valid(residency, mat.albedoTexture) || residency[mat.albedoTexture].count == 0) continue;
+
+      TextureResidency& r        = residency[mat.albedoTexture];
+      const lin::AABB&  bounds   = instanceBounds[groupFirst[item.group] + item.instance];
+      float             diagonal = glm::length(bounds.max - bounds.min);
+      float             depth    = camera.orthoSize > 0.0f ? 1.0f : std::max(item.depth - diagonal * 0.5f, camera.zNear);
+      float             pixels   = diagonal * scale / depth;
+      float             texels   = std::max(r.size.x, r.size.y) * std::max(mat.uvScale.x, mat.uvScale.y);
+      int               level    = pixels > 0.0f ? int(std::log2(std::max(texels / pixels, 1.0f))) : r.count - 1;
+      r.wanted                   = std::min(r.wanted, std::min(level, r.count - 1));
+    }
+  }
 
-    glUniform1i(renderer->pbr_u_useTextures, mat->albedoTexture >= 0);
+  // Drops the finest level of the least recently used textures that did not
+  // want it this frame until bytes more fit in the budget
+  bool residencyEvict(size_t bytes, size_t budget) {
+    while (residentBytes + bytes > budget) {
+      int victim = -1;
+      for (int i = 0; i < residency.size(); i++) {
+        const TextureResidency& r = residency[i];
+        if (r.resident >= r.tail || r.resident >= r.wanted) continue;
+        if (victim < 0 || r.lastUse < residency[victim].lastUse) victim = i;
+      }
+      if (victim < 0) return false;
+
+      TextureResidency& r = residency[victim];
+      bindTexture(victim + TEXT_START_USER);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, r.resident + 1);
+      glTexImage2D(GL_TEXTURE_2D, r.resident, GL_RGB, 0, 0, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+      residentBytes -= residencyBytes(r, r.resident);
+      r.resident++;
+    }
+    return true;
+  }
+
+  // One level per texture and round, textures furthest from what they want
+  // first, until texture_stream_uploads levels went up or the budget is full
+  ENGINE_API void residencyStream() {
+    if (residency.empty()) return;
+    const size_t budget = size_t(_desc.texture_stream_budget) << 20;
+
+    std::vector<int> order;
+    for (int i = 0; i < residency.size(); i++) {
+      TextureResidency& r = residency[i];
+      if (r.count == 0) continue;
+      if (r.wanted <= r.resident) r.lastUse = residencyFrame;
+      if (r.wanted < r.resident) order.push_back(i);
+    }
+    residencyEvict(0, budget);
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+      return residency[a].resident - residency[a].wanted > residency[b].resident - residency[b].wanted;
+    });
+
+    int  uploads = _desc.texture_stream_uploads;
+    bool full    = false;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (bool progress = true; progress && uploads > 0 && !full;) {
+      progress = false;
+      for (int i = 0; i < order.size() && uploads > 0 && !full; i++) {
+        TextureResidency& r = residency[order[i]];
+        if (r.wanted >= r.resident) continue;
+        full = !residencyEvict(residencyBytes(r, r.resident - 1), budget);
+        if (full) break;
+
+        bindTexture(order[i] + TEXT_START_USER);
+        residencyUpload(order[i], r.resident - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, --r.resident);
+        uploads--;
+        progress = true;
+      }
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  ENGINE_API void bindMaterial(Renderer* renderer, Material* mat, const SurfaceUniforms& u) {
+
+    glUniform1i(u.useTextures, mat->albedoTexture >= 0);
     if (mat->albedoTexture >= 0) {
-      glUniform1i(renderer->pbr_u_diffuseTexture, mat->albedoTexture + TEXT_START_USER);
+      glm::ivec2 packing = valid(texturePacking, mat->albedoTexture) ? texturePacking[mat->albedoTexture] : glm::ivec2(-1, 0);
+      if (packing.x >= 0 && packing.x != boundArray) {
+        glActiveTexture(GL_TEXTURE0 + TEXT_MATERIAL_ARRAY);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textureArrays[packing.x]);
+        glActiveTexture(GL_TEXTURE0);
+        boundArray = packing.x;
+      }
+      glUniform1i(u.diffuseLayer, packing.x >= 0 ? packing.y : -1);
+      if (packing.x < 0) glUniform1i(u.diffuseTexture, mat->albedoTexture + TEXT_START_USER);
     } else {
-      glUniform3f(renderer->pbr_u_kd, mat->albedo.x, mat->albedo.y, mat->albedo.z);
-      glUniform3f(renderer->pbr_u_ks, mat->metallic, mat->roughness, mat->roughness);
+      glUniform3f(u.kd, mat->albedo.x, mat->albedo.y, mat->albedo.z);
+      glUniform3f(u.ks, mat->metallic, mat->roughness, mat->roughness);
     }
 
-    VERIFY_OBJECT(renderer->pbr_u_uvScale);
-    VERIFY_OBJECT(renderer->pbr_u_uvOffset);
-    glUniform2f(renderer->pbr_u_uvScale, mat->uvScale.x, mat->uvScale.y);
-    glUniform2f(renderer->pbr_u_uvOffset, mat->uvOffset.x, mat->uvOffset.y);
+    VERIFY_OBJECT(u.uvScale);
+    VERIFY_OBJECT(u.uvOffset);
+    glUniform2f(u.uvScale, mat->uvScale.x, mat->uvScale.y);
+    glUniform2f(u.uvOffset, mat->uvOffset.x, mat->uvOffset.y);
   }
 
-  ENGINE_API int bindMesh(Renderer* renderer, Mesh* mesh, int meshIdx) {
+  ENGINE_API int bindMesh(Renderer* renderer, Mesh* mesh, int meshIdx, const SurfaceUniforms& u) {
     int vertexCount = mesh->tCustom.numVertices;
-    glUniform1i(renderer->pbr_u_flatUV, 0);
+    glUniform1i(u.flatUV, 0);
     switch (mesh->type) {
       case CUSTOM:
         glBindBuffer(GL_ARRAY_BUFFER, renderer->vbos[meshIdx + BUFF_START_USER]);
@@ -360,215 +1131,778 @@ struct Renderer : public IRenderer {
     return vertexCount;
   }
 
-  ENGINE_API void rendererBeginHDR(Renderer* renderer) {
-    glBindFramebuffer(GL_FRAMEBUFFER, renderer->fbos[FBO_HDR_PASS]);
-    glUtilAttachRenderBuffer(RBO_HDR_PASS_DEPTH, GL_DEPTH_STENCIL_ATTACHMENT, GL_DEPTH24_STENCIL8);
-    glUtilAttachScreenTexture(TEXT_ATTACHMENT_COLOR, GL_COLOR_ATTACHMENT0, GL_RGB, GL_RGB16F);
-    glUtilAttachScreenTexture(TEXT_ATTACHMENT_BLOOM, GL_COLOR_ATTACHMENT1, GL_RGB, GL_RGB16F);
-    glDrawBuffers(2, attachments);
-    VERIFY_FRAMEBUFFER;
-  }
-
-  ENGINE_API int rendererFilterGauss(Renderer* renderer, int src, int pingTexture, int pongTexture, int passes) {
-    int fbo = FBO_GAUSS_PASS_PING;
-    int out = pingTexture;
-    int in  = src;
-
-    glUseProgram(renderer->program_filter_gauss);
-    for (int i = 0; i < 2 * passes; i++) {
-      bool horizontal = i % 2;
-      glBindFramebuffer(GL_FRAMEBUFFER, renderer->fbos[FBO_GAUSS_PASS_PING + horizontal]);
-      glUtilAttachScreenTexture(out, GL_COLOR_ATTACHMENT0, GL_RGB, GL_RGB16F);
-      glDrawBuffers(1, attachments);
+  ENGINE_API int graphSlot(int target) { return TEXT_GRAPH_START + graph.targets[target].physical; }
+  ENGINE_API GLuint graphFramebuffer(int pass) { return fbos[FBO_GRAPH_START + pass]; }
+
+  // Allocates the physical textures of the compiled graph and gives every
+  // surviving pass that writes targets a framebuffer with them attached
+  ENGINE_API void graphRealize() {
+    VERIFY(graph.physical.size() <= MAX_GRAPH_TEXTURES, "Render graph needs %d textures\n", (int)graph.physical.size());
+    VERIFY(graph.passes.size() <= MAX_GRAPH_PASSES, "Render graph has %d passes\n", (int)graph.passes.size());
+
+    for (int p = 0; p < graph.physical.size(); p++) {
+      const RenderGraphPhysical& physical = graph.physical[p];
+      const bool                 depth    = physical.format == RG_FORMAT_DEPTH24_STENCIL8;
+      bindTexture(TEXT_GRAPH_START + p);
+      glTexImage2D(GL_TEXTURE_2D, 0, GRAPH_FORMATS[physical.format].internalFormat, physical.size.x, physical.size.y, 0, GRAPH_FORMATS[physical.format].format,
+                   GRAPH_FORMATS[physical.format].type, 0);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, depth ? GL_NEAREST : GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, depth ? GL_NEAREST : GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    SAFETY(glActiveTexture(GL_TEXTURE0));
+
+    // Fresh framebuffers so no attachment of the previous graph survives
+    glDeleteFramebuffers(MAX_GRAPH_PASSES, &fbos[FBO_GRAPH_START]);
+    glGenFramebuffers(MAX_GRAPH_PASSES, &fbos[FBO_GRAPH_START]);
+    for (int p = 0; p < graph.passes.size(); p++) {
+      const RenderGraphPass& pass = graph.passes[p];
+      if (pass.culled || pass.writes.empty()) continue;
+
+      int colors = 0;
+      glBindFramebuffer(GL_FRAMEBUFFER, graphFramebuffer(p));
+      for (int t : pass.writes) {
+        bool   depth      = graph.targets[t].format == RG_FORMAT_DEPTH24_STENCIL8;
+        GLenum attachment = depth ? GL_DEPTH_STENCIL_ATTACHMENT : GL_COLOR_ATTACHMENT0 + colors++;
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, textures[graphSlot(t)], 0);
+      }
+      glDrawBuffers(colors, attachments);
       VERIFY_FRAMEBUFFER;
-      glUniform1i(renderer->filter_gauss_u_input, in);
-      glUniform1i(renderer->filter_gauss_u_horizontal, 1);
-      glUtilRenderScreenQuad();
-      in  = out;
-      out = horizontal ? pingTexture : pongTexture;
     }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    LOG("[RENDERER] Render graph realized, %d targets in %d textures\n", (int)graph.targets.size(), (int)graph.physical.size());
+  }
 
+  ENGINE_API void graphExecute() {
+    for (int p = 0; p < graph.passes.size(); p++) {
+      const RenderGraphPass& pass = graph.passes[p];
+      if (pass.culled) continue;
+      if (pass.writes.empty()) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, desc.surface->getWidth(), desc.surface->getHeight());
+      } else if (!pass.compute) {
+        glm::ivec2 size = graph.targets[pass.writes[0]].size;
+        glBindFramebuffer(GL_FRAMEBUFFER, graphFramebuffer(p));
+        glViewport(0, 0, size.x, size.y);
+      }
+      pass.execute();
+    }
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    return out;
+    glViewport(0, 0, desc.surface->getWidth(), desc.surface->getHeight());
   }
 
-  ENGINE_API int rendererFilterBloom(int src, float width, float height, float filterRadius, int count) {
-    glBindFramebuffer(GL_FRAMEBUFFER, fbos[FBO_BLOOM]);
+  // Separable blur of src into a new target of any size: radius is in output
+  // texels and the first horizontal pass resamples src bilinearly. Every pass
+  // writes a fresh target, aliasing folds them into a ping pong pair.
+  ENGINE_API int graphGauss(int src, glm::ivec2 size, float radius, int passes, RenderGraphFormat format) {
+    float weights[GAUSS_MAX_TAPS];
+    float offsets[GAUSS_MAX_TAPS];
+    int   taps = gaussKernel(radius, weights, offsets);
 
-    glm::vec2 srcSize(width, height);
+    int in = src;
+    for (int i = 0; i < 2 * passes; i++) {
+      bool vertical = i % 2;
+      int  out      = graph.target("gauss", format, size);
+      int  pass     = graph.pass("gauss", [this, in, vertical, size, taps, weights, offsets]() {
+        glUseProgram(program_filter_gauss);
+        glUniform1i(filter_gauss_u_taps, taps);
+        glUniform1fv(filter_gauss_u_weights, taps, weights);
+        glUniform1fv(filter_gauss_u_offsets, taps, offsets);
+        glUniform1i(filter_gauss_u_input, graphSlot(in));
+        glUniform2f(filter_gauss_u_direction, vertical ? 0.0f : 1.0f / size.x, vertical ? 1.0f / size.y : 0.0f);
+        glUtilRenderScreenQuad();
+      });
+      graph.read(pass, in);
+      graph.write(pass, out);
+      in = out;
+    }
+    return in;
+  }
 
-    const int bloom_length = std::min(PARAM_BLOOM_CHAIN_LENGTH, count);
+  // Level i is 1 / (downscale * 2^i) of the source. Levels stop before
+  // either side would drop below one pixel. Returns the level count.
+  ENGINE_API int bloomSizes(int width, int height, int count, int downscale, glm::ivec2* sizes) {
+    VERIFY(count > 0, "Invalid bloom length");
+    VERIFY(downscale == 1 || downscale == 2 || downscale == 4, "Invalid bloom downscale");
+    VERIFY(_desc.bloom_radius >= 1.0f, "Invalid filterRadius");
+
+    // The first level is already half of the source at downscale 1
+    int levels = 0;
+    count      = std::min(PARAM_BLOOM_CHAIN_LENGTH, count);
+    for (int w = width / (downscale * 2), h = height / (downscale * 2); levels < count && w > 0 && h > 0; w /= 2, h /= 2) {
+      sizes[levels++] = glm::ivec2(w, h);
+    }
+    VERIFY(levels > 0, "Surface too small for bloom\n");
+    return levels;
+  }
 
-    VERIFY(bloom_length > 0, "Invalid bloom length");
-    VERIFY(filterRadius >= 1.0f, "Invalid filterRadius");
+  // Mip chain of downsample.fs and additive upsample.fs passes, the radius is
+  // the upsample tent in texels of the level being upsampled. Returns the
+  // target holding the result.
+  ENGINE_API int graphBloom(int src, int width, int height) {
+    glm::ivec2 sizes[PARAM_BLOOM_CHAIN_LENGTH_MAX];
+    int        levels[PARAM_BLOOM_CHAIN_LENGTH_MAX];
+    int        count = bloomSizes(width, height, _desc.bloom_sampling, _desc.bloom_downscale, sizes);
+
+    // Skipping a level in the first step widens the taps to its texel size
+    int       in            = src;
+    glm::vec2 srcResolution = glm::vec2(sizes[0] * 2);
+    for (int i = 0; i < count; i++) {
+      levels[i] = graph.target("bloom", RG_FORMAT_R11G11B10F, sizes[i]);
+      int pass  = graph.pass("bloom downsample", [this, in, srcResolution]() {
+        glUseProgram(program_filter_downsample);
+        glUniform2f(filter_downsample_srcResolution, srcResolution.x, srcResolution.y);
+        glUniform1i(filter_downsample_srcTexture, graphSlot(in));
+        glUtilRenderScreenQuad();
+      });
+      graph.read(pass, in);
+      graph.write(pass, levels[i]);
+      in            = levels[i];
+      srcResolution = glm::vec2(sizes[i]);
+    }
 
-    if (desc.surface->resized()) {
-      LOG("[RENDERER] Bloom update texture and framebuffer");
-      glm::vec2 size(width, height);
-      for (int i = 0; i < bloom_length; i++) {
-        size /= 2;
-        bindTexture(i + TEXT_BLOOM_START);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_R11F_G11F_B10F, (int)size.x, (int)size.y, 0, GL_RGB, GL_FLOAT, 0);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        SAFETY(glActiveTexture(GL_TEXTURE0));
-      }
+    for (int i = count - 1; i > 0; i--) {
+      int        level = levels[i];
+      glm::ivec2 size  = sizes[i];
+      int        pass  = graph.pass("bloom upsample", [this, level, size]() {
+        glUseProgram(program_filter_upsample);
+        glUniform1i(filter_upsample_srcTexture, graphSlot(level));
+        glUniform2f(filter_upsample_filterRadius, _desc.bloom_radius / size.x, _desc.bloom_radius / size.y);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+        glBlendEquation(GL_FUNC_ADD);
+        glUtilRenderScreenQuad();
+        glDisable(GL_BLEND);
+      });
+      graph.read(pass, level);
+      graph.read(pass, levels[i - 1]);
+      graph.write(pass, levels[i - 1]);
+    }
+    return levels[0];
+  }
 
-      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[TEXT_BLOOM_START], 0);
-      glDrawBuffers(1, attachments);
-      VERIFY_FRAMEBUFFER;
+#ifdef GL_UTIL_COMPUTE
+  // Same chain and hdr.fs composite as compute dispatches. The last upsample
+  // is fused with the composite, which writes an RGBA8 image that is blitted
+  // to the default framebuffer.
+  ENGINE_API void graphBloomCompute(int color, int src, int width, int height) {
+    glm::ivec2 sizes[PARAM_BLOOM_CHAIN_LENGTH_MAX];
+    int        levels[PARAM_BLOOM_CHAIN_LENGTH_MAX];
+    int        count   = bloomSizes(width, height, _desc.bloom_sampling, _desc.bloom_downscale, sizes);
+    auto       groups  = [](int size) { return GLuint((size + BLOOM_COMPUTE_TILE - 1) / BLOOM_COMPUTE_TILE); };
+    const auto barrier = GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+
+    int in = src;
+    for (int i = 0; i < count; i++) {
+      int        level = levels[i] = graph.target("bloom", RG_FORMAT_R11G11B10F, sizes[i]);
+      glm::ivec2 size  = sizes[i];
+      int        pass  = graph.pass("bloom downsample", [=]() {
+        glUseProgram(program_bloom_downsample);
+        glUniform1i(bloom_downsample_u_src, graphSlot(in));
+        glBindImageTexture(0, textures[graphSlot(level)], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R11F_G11F_B10F);
+        glDispatchCompute(groups(size.x), groups(size.y), 1);
+        glMemoryBarrier(barrier);
+      });
+      graph.passes[pass].compute = true;
+      graph.read(pass, in);
+      graph.write(pass, level);
+      in = level;
     }
 
+    // Level 1 into level 0 is left to the composite
+    for (int i = count - 1; i > 1; i--) {
+      int        level = levels[i];
+      int        dst   = levels[i - 1];
+      glm::ivec2 size  = sizes[i];
+      glm::ivec2 dstSize = sizes[i - 1];
+      int        pass  = graph.pass("bloom upsample", [=]() {
+        glUseProgram(program_bloom_upsample);
+        glUniform1i(bloom_upsample_u_src, graphSlot(level));
+        glUniform2f(bloom_upsample_u_filterRadius, _desc.bloom_radius / size.x, _desc.bloom_radius / size.y);
+        glBindImageTexture(0, textures[graphSlot(dst)], 0, GL_FALSE, 0, GL_READ_WRITE, GL_R11F_G11F_B10F);
+        glDispatchCompute(groups(dstSize.x), groups(dstSize.y), 1);
+        glMemoryBarrier(barrier);
+      });
+      graph.passes[pass].compute = true;
+      graph.read(pass, level);
+      graph.read(pass, dst);
+      graph.write(pass, dst);
+    }
 
-    glm::vec2 size(width, height);
-    //Downsample
-    {
-      glUseProgram(program_filter_downsample);
-      bindTexture(src);
-      glUniform2f(filter_downsample_srcResolution, size.x, size.y);
-      glUniform1i(filter_downsample_srcTexture, src);
-      for (int i = 0; i < bloom_length; i++) {
-        glViewport(0, 0, size.x / 2, size.y / 2);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i + TEXT_BLOOM_START], 0);
-        VERIFY_FRAMEBUFFER;
-        glUtilRenderScreenQuad();
-        size = size / 2.0f;
-        glUniform2f(filter_downsample_srcResolution, size.x, size.y);
-        glUniform1i(filter_downsample_srcTexture, i + TEXT_BLOOM_START);
+    int        bloom     = levels[0];
+    int        bloomNext = levels[std::min(count - 1, 1)];
+    glm::ivec2 nextSize  = sizes[std::min(count - 1, 1)];
+    int        tonemap   = graph.target("tonemap", RG_FORMAT_RGBA8, glm::ivec2(width, height));
+    int        composite = graph.pass("bloom composite", [=]() {
+      glUseProgram(program_bloom_composite);
+      glUniform1i(bloom_composite_u_color, graphSlot(color));
+      glUniform1i(bloom_composite_u_bloom, graphSlot(bloom));
+      glUniform1i(bloom_composite_u_bloomNext, graphSlot(bloomNext));
+      glUniform2f(bloom_composite_u_filterRadius, _desc.bloom_radius / nextSize.x, _desc.bloom_radius / nextSize.y);
+      glUniform1i(bloom_composite_u_bloomLevels, count);
+      glUniform1f(bloom_composite_u_bloomStrength, _desc.bloom_strength);
+      glBindImageTexture(0, textures[graphSlot(tonemap)], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+      glDispatchCompute(groups(width), groups(height), 1);
+      glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+    });
+    graph.passes[composite].compute = true;
+    graph.read(composite, color);
+    graph.read(composite, bloom);
+    graph.read(composite, bloomNext);
+    graph.write(composite, tonemap);
+
+    int blit = graph.pass("blit", [=]() {
+      glBindFramebuffer(GL_READ_FRAMEBUFFER, graphFramebuffer(composite));
+      glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }, true);
+    graph.read(blit, tonemap);
+  }
+#endif
+
+  // Scene into HDR targets, bloom, and the composite to the default
+  // framebuffer. Passes are declared unconditionally where that is simpler
+  // and compile() drops the ones whose result is not used.
+  ENGINE_API void graphBuild(int width, int height) {
+    const glm::ivec2 size(width, height);
+    graph.clear();
+
+    int color  = graph.target("color", RG_FORMAT_RGB16F, size);
+    int bright = graph.target("bright", RG_FORMAT_RGB16F, size);
+    int depth  = graph.target("depth", RG_FORMAT_DEPTH24_STENCIL8, size);
+    int scene  = graph.pass("scene", [this]() { rendererPass(this, graphScene, graphViews, graphViewCount); });
+    graph.write(scene, color);
+    // Without bloom the bright pass output is dropped instead of written
+    if (_desc.bloom_enable) graph.write(scene, bright);
+    graph.write(scene, depth);
+
+    int bloom = -1;
+    if (_desc.bloom_enable) {
+#ifdef GL_UTIL_COMPUTE
+      if (_desc.bloom_compute && computeSupported && _desc.bloom_gauss_radius <= 0.0f) {
+        graphBloomCompute(color, bright, width, height);
+        graph.compile();
+        return;
       }
+#endif
+      int chain = graphBloom(bright, width, height);
+      int gauss = graphGauss(bright, size / 2, std::max(_desc.bloom_gauss_radius, 1.0f), 1, RG_FORMAT_RGB16F);
+      bloom     = _desc.bloom_gauss_radius > 0.0f ? gauss : chain;
     }
-    //Upsample
-    {
-      glUseProgram(program_filter_upsample);
-      glUniform1i(filter_upsample_filterRadius, filterRadius);
-      glEnable(GL_BLEND);
-      glBlendFunc(GL_ONE, GL_ONE);
-      glBlendEquation(GL_FUNC_ADD);
-
-      for (int i = bloom_length - 1; i > 0; i--) {
-        int texture        = TEXT_BLOOM_START + i;
-        int nextMipTexture = texture - 1;
-
-        glUniform1i(filter_upsample_srcTexture, texture);
-        glViewport(0, 0, size.x * 2, size.y * 2);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[nextMipTexture], 0);
-        VERIFY_FRAMEBUFFER;
-        glUtilRenderScreenQuad();
 
-        size *= 2.0f;
+    int hdr = graph.pass("hdr", [this, color, bloom]() {
+      glUseProgram(program_hdr);
+      glUniform1i(hdr_u_color, graphSlot(color));
+      glUniform1i(hdr_u_bloom, graphSlot(bloom >= 0 ? bloom : color));
+      glUniform1f(hdr_u_bloomStrength, bloom >= 0 ? _desc.bloom_strength : 0.0f);
+      glUtilRenderScreenQuad();
+    }, true);
+    graph.read(hdr, color);
+    if (bloom >= 0) graph.read(hdr, bloom);
+    graph.compile();
+  }
+
+  ENGINE_API bool graphDirty(int width, int height) {
+    const RendererDesc& a = graphDesc;
+    const RendererDesc& b = _desc;
+    return graphSize != glm::ivec2(width, height) || a.bloom_enable != b.bloom_enable || a.bloom_compute != b.bloom_compute ||
+           a.bloom_downscale != b.bloom_downscale || a.bloom_sampling != b.bloom_sampling || a.bloom_gauss_radius != b.bloom_gauss_radius;
+  }
+
+  // Splits [zNear, distance] of the camera between the cascades, blending
+  // logarithmic and uniform splits, and fits a texel snapped orthographic
+  // light camera around the bounding sphere of every slice so the cascades
+  // do not shimmer when the camera moves
+  ENGINE_API void shadowFitCascades(const Camera& camera, const Light& light) {
+    const float zNear    = camera.zNear;
+    const float zFar     = std::min(camera.zFar, _desc.shadowmapping_distance);
+    const float lambda   = 0.75f;
+    const float tanHalf  = std::tan(camera.fov * 0.5f);
+    glm::vec3   forward  = glm::normalize(camera.direction);
+    glm::vec3   right    = glm::normalize(glm::cross(forward, camera.up));
+    glm::vec3   up       = glm::cross(right, forward);
+    glm::vec3   lightDir = glm::normalize(light.direction);
+    glm::vec3   lightUp  = std::abs(lightDir.y) > 0.99f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+    glm::mat4   lightRot = glm::lookAt(glm::vec3(0.0f), lightDir, lightUp);
+    glm::mat4   lightInv = glm::inverse(lightRot);
+
+    shadowCascades = std::min(std::max(_desc.shadowmapping_cascades, 1), MAX_SHADOW_CASCADES);
+    float begin    = zNear;
+    for (int i = 0; i < shadowCascades; i++) {
+      float t   = float(i + 1) / shadowCascades;
+      float end = lambda * zNear * std::pow(zFar / zNear, t) + (1.0f - lambda) * (zNear + (zFar - zNear) * t);
+
+      glm::vec3 corners[8];
+      for (int c = 0; c < 8; c++) {
+        float depth = c < 4 ? begin : end;
+        float h     = camera.orthoSize > 0.0f ? camera.orthoSize : depth * tanHalf;
+        float w     = h * camera.ra;
+        corners[c]  = camera.position + forward * depth + right * (c & 1 ? w : -w) + up * (c & 2 ? h : -h);
       }
-      glDisable(GL_BLEND);
+
+      glm::vec3 center(0.0f);
+      for (int c = 0; c < 8; c++) center += corners[c] / 8.0f;
+      float radius = 0.0f;
+      for (int c = 0; c < 8; c++) radius = std::max(radius, glm::length(corners[c] - center));
+      radius = std::ceil(radius * 16.0f) / 16.0f;
+
+      glm::vec3 texel = glm::vec3(2.0f * radius / _desc.shadowmapping_width, 2.0f * radius / _desc.shadowmapping_height, 1.0f);
+      glm::vec3 local = glm::vec3(lightRot * glm::vec4(center, 1.0f));
+      local           = glm::floor(local / texel) * texel;
+      center          = glm::vec3(lightInv * glm::vec4(local, 1.0f));
+
+      // Casters up to the shadow distance behind the slice are kept
+      Camera& shadow   = shadowCameras[i];
+      shadow.direction = lightDir;
+      shadow.up        = lightUp;
+      shadow.ra        = float(_desc.shadowmapping_width) / _desc.shadowmapping_height;
+      shadow.orthoSize = radius;
+      shadow.position  = center - lightDir * (radius + _desc.shadowmapping_distance);
+      shadow.zNear     = 0.0f;
+      shadow.zFar      = 2.0f * radius + _desc.shadowmapping_distance;
+      shadow.update();
+
+      static const glm::mat4 bias = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)) * glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+      shadowMats[i]               = bias * shadow.viewProj;
+      shadowSplits[i]             = end;
+      begin                       = end;
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glViewport(0, 0, desc.surface->getWidth(), desc.surface->getHeight());
-    return TEXT_BLOOM_START;
   }
 
   ENGINE_API void passShadowMapBegin() {
-    glBindFramebuffer(GL_FRAMEBUFFER, FBO_SHADOW_MAP);
-    if (desc.surface->resized()) {
-      LOG("[RENDERER] Shadow map update init\n");
-      bindTexture(TEXT_SHADOW_MAP);
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, _desc.shadowmapping_width, _desc.shadowmapping_height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, textures[TEXT_SHADOW_MAP], 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbos[FBO_SHADOW_MAP]);
+    if (shadowWidth != _desc.shadowmapping_width || shadowHeight != _desc.shadowmapping_height || shadowLayers != shadowCascades) {
+      shadowWidth  = _desc.shadowmapping_width;
+      shadowHeight = _desc.shadowmapping_height;
+      shadowLayers = shadowCascades;
+      LOG("[RENDERER] Shadow map update init %dx%d with %d cascades\n", shadowWidth, shadowHeight, shadowLayers);
+
+      glActiveTexture(GL_TEXTURE0 + TEXT_SHADOW_MAP);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, textures[TEXT_SHADOW_MAP]);
+      glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, shadowWidth, shadowHeight, shadowLayers, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+      glActiveTexture(GL_TEXTURE0);
+
+      glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textures[TEXT_SHADOW_MAP], 0, 0);
       glDrawBuffer(GL_NONE);
       glReadBuffer(GL_NONE);
+      VERIFY_FRAMEBUFFER;
     }
 
-
-    glViewport(0, 0, _desc.shadowmapping_width, _desc.shadowmapping_height);
-    glClear(GL_DEPTH_BUFFER_BIT);
+    glViewport(0, 0, shadowWidth, shadowHeight);
+    glUseProgram(program_depth);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
   }
 
   ENGINE_API void passShadowMapEnd() {
-    glBindTexture(GL_FRAMEBUFFER, 0);
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glViewport(0, 0, desc.surface->getWidth(), desc.surface->getHeight());
   }
 
-  ENGINE_API void renderScene(Renderer* renderer, Scene* scene, Stage* stage, float* viewMat, float* projMat) {
-
-    glUniformMatrix4fv(renderer->pbr_u_ViewMat, 1, 0, viewMat);
-    glUniformMatrix4fv(renderer->pbr_u_ProjMat, 1, 0, projMat);
+  // Depth of the draw list only, no material or uniform work. Matrices are
+  // passed as in pbr.vs so both programs produce the same invariant depth.
+  ENGINE_API void renderDepth(Scene* scene, Stage* stage, const Camera& camera) {
+    glUniformMatrix4fv(depth_u_ViewMat, 1, 0, &camera.view[0][0]);
+    glUniformMatrix4fv(depth_u_ProjMat, 1, 0, &camera.proj[0][0]);
 
-    for (int d = 0; d < stage->instances.size(); d++) {
-      ObjectInstanceGroup* g    = &stage->instances[d];
+    int bound = -1;
+    for (const DrawItem& item : drawList) {
+      ObjectInstanceGroup* g    = &stage->instances[item.group];
       Object*              obj  = &stage->objects[g->object];
       Mesh*                mesh = &scene->meshes[obj->mesh];
-      Material*            mat  = &scene->materials[obj->material];
+      if (mesh->type != CUSTOM) continue;
+
+      if (obj->mesh != bound) {
+        glBindBuffer(GL_ARRAY_BUFFER, vbos[obj->mesh + BUFF_START_USER]);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebos[obj->mesh + BUFF_START_USER]);
+        glUtilsSetVertexAttribs(mesh->tCustom.meshFormat);
+        bound = obj->mesh;
+      }
+      glUniformMatrix4fv(depth_u_WorldMat, 1, 0, (float*)&g->transforms[item.instance][0][0]);
+      glDrawElements(GL_TRIANGLES, mesh->tCustom.numIndices, GL_UNSIGNED_INT, 0);
+    }
+  }
+
+  ENGINE_API void passShadowMap(Scene* scene, Stage* stage, const Camera& camera) {
+    const Light* sun = nullptr;
+    for (const Light& light : stage->lights) {
+      if (light.type == DIRECTIONAL) {
+        sun = &light;
+        break;
+      }
+    }
+
+    shadowCascades = 0;
+    if (!_desc.shadowmapping_enable || sun == nullptr) return;
+
+    shadowFitCascades(camera, *sun);
+    passShadowMapBegin();
+    for (int i = 0; i < shadowCascades; i++) {
+      glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, textures[TEXT_SHADOW_MAP], 0, i);
+      glClear(GL_DEPTH_BUFFER_BIT);
+      buildDrawList(stage, shadowCameras[i]);
+      renderDepth(scene, stage, shadowCameras[i]);
+    }
+    passShadowMapEnd();
+  }
 
+  // World bounds of every instance of the stage, groupFirst[d] is the first
+  // instance of group d and groupFirst.back() the total count
+  ENGINE_API void prepareStage(Scene* scene, Stage* stage) {
+    groupFirst.resize(stage->instances.size() + 1);
+    int count = 0;
+    for (int d = 0; d < stage->instances.size(); d++) {
+      groupFirst[d] = count;
+      count += stage->instances[d].transforms.size();
+    }
+    groupFirst.back() = count;
+    instanceBounds.resize(count);
+    instanceVisible.resize(count);
 
+    for (int d = 0; d < stage->instances.size(); d++) {
+      ObjectInstanceGroup* g = &stage->instances[d];
       VERIFY(valid(stage->objects, g->object), "Invalid object index %d\n", g->object);
-      VERIFY(valid(scene->materials, obj->material), "Invalid material index %d\n", obj->material);
-      VERIFY(valid(scene->meshes, obj->mesh), "Invalid mesh index %d\n", obj->mesh);
+      Object* obj = &stage->objects[g->object];
+      VERIFY(valid(meshBounds, obj->mesh), "Mesh %d was not uploaded\n", obj->mesh);
+      lin::transformAABB(g->transforms.data(), meshBounds[obj->mesh], &instanceBounds[groupFirst[d]], g->transforms.size());
+    }
+  }
 
-      //Bind mesh and materials
-      int vertexCount = bindMesh(renderer, mesh, obj->mesh);
-      if (mesh->type == CUSTOM) glUtilsSetVertexAttribs(mesh->tCustom.meshFormat);
-      bindMaterial(renderer, mat);
+  // Culls the stage for a camera and orders what is left front to back. Groups
+  // are sorted by their nearest instance and instances inside a group by
+  // depth, so early Z rejects most hidden fragments while mesh and material
+  // binds still happen once per group.
+  ENGINE_API void buildDrawList(Stage* stage, const Camera& camera) {
+    lin::cullAABB(camera.planes, instanceBounds.data(), instanceVisible.data(), instanceBounds.size());
 
-      for (int i = 0; i < g->transforms.size(); i++) {
-        glUniformMatrix4fv(renderer->pbr_u_WorldMat, 1, 0, (float*)&g->transforms[i][0][0]);
-        glDrawElements(GL_TRIANGLES, vertexCount, GL_UNSIGNED_INT, 0);
+    const glm::vec3 forward = glm::normalize(camera.direction);
+    drawList.clear();
+    for (int d = 0; d < stage->instances.size(); d++) {
+      const int begin   = drawList.size();
+      float     nearest = FLT_MAX;
+      for (int i = groupFirst[d]; i < groupFirst[d + 1]; i++) {
+        if (!instanceVisible[i]) continue;
+        glm::vec3 center = (instanceBounds[i].min + instanceBounds[i].max) * 0.5f;
+        float     depth  = glm::dot(center - camera.position, forward);
+        nearest          = std::min(nearest, depth);
+        drawList.push_back({0.0f, depth, d, i - groupFirst[d]});
       }
+      for (int i = begin; i < drawList.size(); i++) drawList[i].groupDepth = nearest;
     }
+
+    std::sort(drawList.begin(), drawList.end(), [](const DrawItem& a, const DrawItem& b) {
+      if (a.groupDepth != b.groupDepth) return a.groupDepth < b.groupDepth;
+      if (a.group != b.group) return a.group < b.group;
+      return a.depth < b.depth;
+    });
   }
 
-  ENGINE_API void rendererPass(Renderer* renderer, Scene* scene) {
-    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glUseProgram(renderer->program_pbr);
+  ENGINE_API void renderScene(Renderer* renderer, Scene* scene, Stage* stage, const Camera& camera, const SurfaceUniforms& u) {
 
-    Stage* stage = scene->currentStage();
+    glUniformMatrix4fv(u.viewMat, 1, 0, &camera.view[0][0]);
+    glUniformMatrix4fv(u.projMat, 1, 0, &camera.proj[0][0]);
+
+    int bound       = -1;
+    int vertexCount = 0;
+    for (const DrawItem& item : drawList) {
+      ObjectInstanceGroup* g = &stage->instances[item.group];
+
+      if (item.group != bound) {
+        Object*   obj  = &stage->objects[g->object];
+        Mesh*     mesh = &scene->meshes[obj->mesh];
+        Material* mat  = &scene->materials[obj->material];
+
+        VERIFY(valid(scene->materials, obj->material), "Invalid material index %d\n", obj->material);
+        VERIFY(valid(scene->meshes, obj->mesh), "Invalid mesh index %d\n", obj->mesh);
 
-    float* viewMat = lin::viewMatrix(stage->camPos, stage->camDir);
-    float* projMat = lin::projMatrix(desc.surface->ra());
+        //Bind mesh and materials
+        vertexCount = bindMesh(renderer, mesh, obj->mesh, u);
+        if (mesh->type == CUSTOM) glUtilsSetVertexAttribs(mesh->tCustom.meshFormat);
+        bindMaterial(renderer, mat, u);
+        bound = item.group;
+      }
+
+      glUniformMatrix4fv(u.worldMat, 1, 0, (float*)&g->transforms[item.instance][0][0]);
+      glDrawElements(GL_TRIANGLES, vertexCount, GL_UNSIGNED_INT, 0);
+    }
+  }
+
+  // Background quad, pbr.vs pushes it to the far plane so it is only shaded
+  // where no object was drawn
+  ENGINE_API void renderSky(Renderer* renderer) {
+    glDepthFunc(GL_LEQUAL);
+    glDepthMask(GL_FALSE);
+    glDisable(GL_CULL_FACE);
+    glUniform1i(renderer->pbr_u_isBack, 1);
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->vbos[BUFF_PLAIN]);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, renderer->ebos[BUFF_PLAIN]);
+    glUtilsSetVertexAttribs(0);
+    glUniformMatrix4fv(renderer->pbr_u_WorldMat, 1, 0, lin::meshTransformPlaneScreen());
+    glUniformMatrix4fv(renderer->pbr_u_ViewMat, 1, 0, lin::id());
+    glUniformMatrix4fv(renderer->pbr_u_ProjMat, 1, 0, lin::id());
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    glUniform1i(renderer->pbr_u_isBack, 0);
+    glEnable(GL_CULL_FACE);
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+  }
+
+  ENGINE_API void renderView(Renderer* renderer, Scene* scene, Stage* stage, const View& view) {
+    const Camera& camera = view.camera;
+    glViewport(view.x, view.y, view.width, view.height);
+    buildDrawList(stage, camera);
+    residencyMeasure(scene, stage, view);
+
+    // Depth only pass, the color pass then shades each pixel once
+    if (_desc.depth_prepass_enable) {
+      glUseProgram(renderer->program_depth);
+      renderDepth(scene, stage, camera);
+      glUseProgram(renderer->program_pbr);
+      glDepthFunc(GL_EQUAL);
+      glDepthMask(GL_FALSE);
+    }
 
     //TODO HINT
-    if(stage->skyTexture >= 0) { 
+    if (stage->skyTexture >= 0) {
       VERIFY(stage->skyTexture >= 0 && stage->skyTexture < scene->textures.size(), "Invalid sky texture\n");
       glUniform1i(renderer->pbr_u_envMap, stage->skyTexture + TEXT_START_USER);
     }
-    glUniform3f(renderer->pbr_u_ro, stage->camPos.x, stage->camPos.y, stage->camPos.z);
-    glUniform3f(renderer->pbr_u_rd, stage->camDir.x, stage->camDir.y, stage->camDir.z);
+    glUniform3f(renderer->pbr_u_ro, camera.position.x, camera.position.y, camera.position.z);
+    glUniform3f(renderer->pbr_u_rd, camera.direction.x, camera.direction.y, camera.direction.z);
 
-    glUniform1i(renderer->pbr_u_isBack, 1);
-    glUtilRenderQuad(renderer->vbos[BUFF_PLAIN], renderer->ebos[BUFF_PLAIN], renderer->pbr_u_WorldMat, renderer->pbr_u_ViewMat, renderer->pbr_u_ProjMat);
-    glUniform1i(renderer->pbr_u_isBack, 0);
-    renderScene(renderer, scene, stage, viewMat, projMat);
+    glUniform1i(renderer->pbr_u_clustered, _desc.clustered_enable);
+    if (_desc.clustered_enable) {
+      uploadLightGrid(stage, view);
+      setClusterUniforms(clusterPbr, view);
+    }
+
+    renderScene(renderer, scene, stage, camera, surfacePbr);
+    renderSky(renderer);
+  }
+
+  // Storage grows to fit and is never shrunk, so steady frames only update it
+  ENGINE_API void uploadDataTexture(int slot, glm::ivec2* capacity, GLenum internalFormat, GLenum format, GLenum type, int width, int height, const void* data) {
+    glActiveTexture(GL_TEXTURE0 + slot);
+    glBindTexture(GL_TEXTURE_2D, textures[slot]);
+    if (width > capacity->x || height > capacity->y) {
+      capacity->x = std::max(capacity->x, width);
+      capacity->y = std::max(capacity->y, height);
+      glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, capacity->x, capacity->y, 0, format, type, NULL);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    if (width > 0 && height > 0) glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, type, data);
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  ENGINE_API void gbufferAttach(int slot, GLenum attachment, GLenum internalFormat, GLenum format, GLenum type) {
+    glActiveTexture(GL_TEXTURE0 + slot);
+    glBindTexture(GL_TEXTURE_2D, textures[slot]);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, gbufferWidth, gbufferHeight, 0, format, type, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, textures[slot], 0);
+    glActiveTexture(GL_TEXTURE0);
   }
 
-  ENGINE_API void rendererEnd() { glBindFramebuffer(GL_FRAMEBUFFER, 0); }
-  ENGINE_API void rendererHDR(Renderer* renderer, Scene* scene) {
-    rendererBeginHDR(renderer);
-    rendererPass(renderer, scene);
-    rendererEnd();
+  ENGINE_API void gbufferBegin() {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbos[FBO_GBUFFER]);
+    if (gbufferWidth != desc.surface->getWidth() || gbufferHeight != desc.surface->getHeight()) {
+      gbufferWidth  = desc.surface->getWidth();
+      gbufferHeight = desc.surface->getHeight();
+      LOG("[RENDERER] G-buffer update %dx%d\n", gbufferWidth, gbufferHeight);
+      gbufferAttach(TEXT_GBUFFER_ALBEDO, GL_COLOR_ATTACHMENT0, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+      gbufferAttach(TEXT_GBUFFER_NORMAL, GL_COLOR_ATTACHMENT1, GL_RGBA16F, GL_RGBA, GL_FLOAT);
+      gbufferAttach(TEXT_GBUFFER_DEPTH, GL_DEPTH_STENCIL_ATTACHMENT, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8);
+      glDrawBuffers(2, attachments);
+      VERIFY_FRAMEBUFFER;
+    }
+  }
 
-    //int gaussBloomResult = rendererFilterGauss(renderer, TEXT_ATTACHMENT_BLOOM, TEXT_GAUSS_RESULT0, TEXT_GAUSS_RESULT02, desc.gauss_passes);
-    int bloomResult = rendererFilterBloom(TEXT_ATTACHMENT_BLOOM, desc.surface->getWidth(), desc.surface->getHeight(), _desc.bloom_radius, _desc.bloom_sampling);
-    glUseProgram(renderer->program_hdr);
-    glUniform1i(renderer->hdr_u_bloom, bloomResult);
-    glUniform1i(renderer->hdr_u_color, TEXT_ATTACHMENT_COLOR);
+  // Three texels per light: position and radius, color times intensity and
+  // type, direction
+  ENGINE_API void uploadLights(Stage* stage) {
+    const int count = stage->lights.size();
+    lightData.resize(count * 12);
+    for (int i = 0; i < count; i++) {
+      const Light& light     = stage->lights[i];
+      glm::vec3    color     = light.color * light.intensity;
+      glm::vec3    direction = light.type == POINT ? glm::vec3(0.0f) : glm::normalize(light.direction);
+      float*       data      = &lightData[i * 12];
+      data[0]                = light.position.x;
+      data[1]                = light.position.y;
+      data[2]                = light.position.z;
+      data[3]                = light.radius;
+      data[4]                = color.x;
+      data[5]                = color.y;
+      data[6]                = color.z;
+      data[7]                = float(light.type);
+      data[8]                = direction.x;
+      data[9]                = direction.y;
+      data[10]               = direction.z;
+      data[11]               = 0.0f;
+    }
+    uploadDataTexture(TEXT_LIGHTS, &lightsCapacity, GL_RGBA32F, GL_RGBA, GL_FLOAT, 3, count, lightData.data());
+  }
 
-    VERIFY(renderer->hdr_u_bloom != renderer->hdr_u_color, "Invalid uniform values\n");
-    glUtilRenderScreenQuad();
+  ENGINE_API void uploadLightGrid(Stage* stage, const View& view) {
+    lightGridBuild(&lightGrid, stage->lights.data(), stage->lights.size(), view.camera, view.width, view.height);
+    const int rows = (lightGrid.indices.size() + LIGHT_INDEX_WIDTH - 1) / LIGHT_INDEX_WIDTH;
+    lightGrid.indices.resize(rows * LIGHT_INDEX_WIDTH);
+    uploadDataTexture(TEXT_LIGHT_TILES, &lightTilesCapacity, GL_RG32I, GL_RG_INTEGER, GL_INT, lightGrid.tilesX, lightGrid.tilesY * lightGrid.slices, lightGrid.tiles.data());
+    uploadDataTexture(TEXT_LIGHT_INDICES, &lightIndicesCapacity, GL_R32I, GL_RED_INTEGER, GL_INT, LIGHT_INDEX_WIDTH, rows, lightGrid.indices.data());
   }
 
-  ENGINE_API void rendererRegular(Renderer* renderer, Scene* scene) {
-    rendererPass(renderer, scene);
+  // Expects the program owning the locations to be in use
+  ENGINE_API void setClusterUniforms(const ClusterUniforms& u, const View& view) {
+    glUniform2i(u.viewOrigin, view.x, view.y);
+    glUniform1i(u.tileSize, lightGrid.tileSize);
+    glUniform1i(u.tilesY, lightGrid.tilesY);
+    glUniform1i(u.slices, lightGrid.slices);
+    glUniform1f(u.scale, lightGrid.sliceScale);
+    glUniform1f(u.bias, lightGrid.sliceBias);
+    glUniform1i(u.globals, lightGrid.globalCount);
+  }
+
+  // Geometry goes to the G-buffer, then one screen pass over the view lights
+  // every pixel with the lights of its cluster and writes the G-buffer depth so
+  // the sky and later forward draws still depth test against the scene
+  ENGINE_API void renderViewDeferred(Renderer* renderer, Scene* scene, Stage* stage, const View& view, GLuint target) {
+    const Camera& camera = view.camera;
+    buildDrawList(stage, camera);
+    residencyMeasure(scene, stage, view);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbos[FBO_GBUFFER]);
+    glViewport(view.x, view.y, view.width, view.height);
+    glUseProgram(renderer->program_gbuffer);
+    renderScene(renderer, scene, stage, camera, surfaceGbuffer);
+
+    uploadLightGrid(stage, view);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, target);
+    glUseProgram(renderer->program_deferred);
+    setClusterUniforms(clusterDeferred, view);
+    glm::mat4 invViewProj = glm::inverse(camera.viewProj);
+    glUniformMatrix4fv(renderer->deferred_u_invViewProj, 1, 0, &invViewProj[0][0]);
+    glUniformMatrix4fv(renderer->deferred_u_ViewMat, 1, 0, &camera.view[0][0]);
+    glUniform3f(renderer->deferred_u_ro, camera.position.x, camera.position.y, camera.position.z);
+    if (stage->skyTexture >= 0) glUniform1i(renderer->deferred_u_envMap, stage->skyTexture + TEXT_START_USER);
+
+    glDepthFunc(GL_ALWAYS);
+    glDisable(GL_CULL_FACE);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glEnable(GL_CULL_FACE);
+    glDepthFunc(GL_LESS);
+
+    glUseProgram(renderer->program_pbr);
+    if (stage->skyTexture >= 0) glUniform1i(renderer->pbr_u_envMap, stage->skyTexture + TEXT_START_USER);
+    glUniform3f(renderer->pbr_u_ro, camera.position.x, camera.position.y, camera.position.z);
+    glUniform3f(renderer->pbr_u_rd, camera.direction.x, camera.direction.y, camera.direction.z);
+    renderSky(renderer);
+  }
+
+  ENGINE_API void setShadowUniforms(GLuint program, GLuint cascades, GLuint mats, GLuint splits) {
+    glUseProgram(program);
+    glUniform1i(cascades, shadowCascades);
+    if (shadowCascades > 0) {
+      glUniformMatrix4fv(mats, shadowCascades, 0, &shadowMats[0][0][0]);
+      glUniform4f(splits, shadowSplits[0], shadowSplits[1], shadowSplits[2], shadowSplits[3]);
+    }
+  }
+
+  ENGINE_API void rendererPass(Renderer* renderer, Scene* scene, const View* views, int count) {
+    GLint target;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+    Stage* stage = scene->currentStage();
+
+    if (_desc.deferred_enable || _desc.clustered_enable) uploadLights(stage);
+    if (_desc.deferred_enable) {
+      gbufferBegin();
+      glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      setShadowUniforms(renderer->program_deferred, renderer->deferred_u_shadowCascades, renderer->deferred_u_shadowMats, renderer->deferred_u_shadowSplits);
+      glBindFramebuffer(GL_FRAMEBUFFER, target);
+    }
+
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    setShadowUniforms(renderer->program_pbr, renderer->pbr_u_shadowCascades, renderer->pbr_u_shadowMats, renderer->pbr_u_shadowSplits);
+
+    for (int i = 0; i < count; i++) {
+      if (_desc.deferred_enable) renderViewDeferred(renderer, scene, stage, views[i], target);
+      else renderView(renderer, scene, stage, views[i]);
+    }
+    glViewport(0, 0, desc.surface->getWidth(), desc.surface->getHeight());
+  }
+
+  // Work shared by every view of the frame: instance bounds and shadow maps
+  ENGINE_API void rendererPrepare(Renderer* renderer, Scene* scene, const Camera& camera) {
+    Stage* stage = scene->currentStage();
+    prepareStage(scene, stage);
+    residencyBegin(stage);
+    passShadowMap(scene, stage, camera);
+  }
+
+  ENGINE_API void rendererHDR(Renderer* renderer, Scene* scene, const View* views, int count) {
+    const int width  = desc.surface->getWidth();
+    const int height = desc.surface->getHeight();
+    if (graphDirty(width, height)) {
+      graphBuild(width, height);
+      graphRealize();
+      graphDesc = _desc;
+      graphSize = glm::ivec2(width, height);
+    }
+
+    graphScene     = scene;
+    graphViews     = views;
+    graphViewCount = count;
+    graphExecute();
+  }
+
+  ENGINE_API void rendererRegular(Renderer* renderer, Scene* scene, const View* views, int count) {
+    rendererPass(renderer, scene, views, count);
   }
   ENGINE_API void render(Scene* scene) override {
 
     if (desc.surface->getWidth() <= 0 || desc.surface->getHeight() <= 0) return;
 
     VERIFY(checkScene(scene), "Invalid scene graph\n");
+
+    View view;
+    view.camera = scene->currentStage()->camera(desc.surface->ra());
+    view.width  = desc.surface->getWidth();
+    view.height = desc.surface->getHeight();
+
+    if (_desc.shader_reload_enable) glUtilReloadPrograms();
     glBindVertexArray(vao);
-    rendererHDR(this, scene);
+    rendererPrepare(this, scene, view.camera);
+    rendererHDR(this, scene, &view, 1);
+    residencyStream();
+    glBindVertexArray(0);
+  }
+
+  ENGINE_API void renderViews(Scene* scene, const View* views, int count) override {
+
+    VERIFY(checkScene(scene), "Invalid scene graph\n");
+    if (count <= 0) return;
+
+    if (_desc.shader_reload_enable) glUtilReloadPrograms();
+
+    // Shadows are fit to the first view and shared by the rest
+    GLint target;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+    glBindVertexArray(vao);
+    rendererPrepare(this, scene, views[0].camera);
+    glBindFramebuffer(GL_FRAMEBUFFER, target);
+    rendererPass(this, scene, views, count);
+    residencyStream();
     glBindVertexArray(0);
   }
 
@@ -578,6 +1912,51 @@ struct Renderer : public IRenderer {
 };
 
 
+// Locations and sampler units of every program, queried again whenever a
+// watched program is swapped
+static void rendererUniforms(Renderer* renderer) {
+#define UNIFORM_ASSIGN(o, u) \
+  renderer->u##_##o = glGetUniformLocation(renderer->program_##u, #o);
+
+  UNIFORMLIST(UNIFORM_ASSIGN)
+#ifdef GL_UTIL_COMPUTE
+  if (renderer->computeSupported) {
+    UNIFORMLIST_COMPUTE(UNIFORM_ASSIGN)
+  }
+#endif
+#undef UNIFORM_ASSIGN
+
+  // The shadow sampler keeps its own unit so it never aliases a 2D sampler
+  glUseProgram(renderer->program_pbr);
+  glUniform1i(renderer->pbr_u_shadowMap, TEXT_SHADOW_MAP);
+  glUniform1i(renderer->pbr_u_lights, TEXT_LIGHTS);
+  glUniform1i(renderer->pbr_u_lightTiles, TEXT_LIGHT_TILES);
+  glUniform1i(renderer->pbr_u_lightIndices, TEXT_LIGHT_INDICES);
+  glUniform1i(renderer->pbr_u_diffuseArray, TEXT_MATERIAL_ARRAY);
+  glUseProgram(renderer->program_gbuffer);
+  glUniform1i(renderer->gbuffer_u_diffuseArray, TEXT_MATERIAL_ARRAY);
+  glUseProgram(renderer->program_deferred);
+  glUniform1i(renderer->deferred_u_shadowMap, TEXT_SHADOW_MAP);
+  glUniform1i(renderer->deferred_u_albedo, TEXT_GBUFFER_ALBEDO);
+  glUniform1i(renderer->deferred_u_normal, TEXT_GBUFFER_NORMAL);
+  glUniform1i(renderer->deferred_u_depth, TEXT_GBUFFER_DEPTH);
+  glUniform1i(renderer->deferred_u_lights, TEXT_LIGHTS);
+  glUniform1i(renderer->deferred_u_lightTiles, TEXT_LIGHT_TILES);
+  glUniform1i(renderer->deferred_u_lightIndices, TEXT_LIGHT_INDICES);
+  glUseProgram(0);
+
+  renderer->surfacePbr     = {renderer->pbr_u_ViewMat, renderer->pbr_u_ProjMat, renderer->pbr_u_WorldMat, renderer->pbr_u_flatUV, renderer->pbr_u_uvScale,
+                              renderer->pbr_u_uvOffset, renderer->pbr_u_kd, renderer->pbr_u_ks, renderer->pbr_u_useTextures, renderer->pbr_u_diffuseTexture,
+                              renderer->pbr_u_diffuseLayer};
+  renderer->clusterPbr      = {renderer->pbr_u_viewOrigin, renderer->pbr_u_tileSize, renderer->pbr_u_tilesY, renderer->pbr_u_clusterSlices,
+                              renderer->pbr_u_clusterScale, renderer->pbr_u_clusterBias, renderer->pbr_u_lightGlobals};
+  renderer->clusterDeferred = {renderer->deferred_u_viewOrigin, renderer->deferred_u_tileSize, renderer->deferred_u_tilesY, renderer->deferred_u_clusterSlices,
+                              renderer->deferred_u_clusterScale, renderer->deferred_u_clusterBias, renderer->deferred_u_lightGlobals};
+  renderer->surfaceGbuffer = {renderer->gbuffer_u_ViewMat, renderer->gbuffer_u_ProjMat, renderer->gbuffer_u_WorldMat, renderer->gbuffer_u_flatUV, renderer->gbuffer_u_uvScale,
+                              renderer->gbuffer_u_uvOffset, renderer->gbuffer_u_kd, renderer->gbuffer_u_ks, renderer->gbuffer_u_useTextures, renderer->gbuffer_u_diffuseTexture,
+                              renderer->gbuffer_u_diffuseLayer};
+}
+
 /* GL CALLBACKS*/
 ENGINE_API void GLAPIENTRY MessageCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam) {
   fprintf(stdout, "GL CALLBACK: %s type = 0x%x, severity = 0x%x, message = %s\n", (type == GL_DEBUG_TYPE_ERROR ? "** GL ERROR **" : ""), type, severity, message);
@@ -624,17 +2003,57 @@ ENGINE_API IRenderer* rendererCreate(RendererDesc desc) {
     glBindVertexArray(0);
   }
 
-#define PROGRAM_ASSIGN(name, vs, fs)                    \
-  renderer->program_##name = glUtilLoadProgram(vs, fs); \
+  glUtilProgramCache(desc.program_cache_path);
+
+#define PROGRAM_LOAD(name, vs, fs, include) {vs, fs, nullptr, nullptr, include},
+  GLUtilProgramLoad programLoads[] = {PROGRAMLIST(PROGRAM_LOAD)};
+#undef PROGRAM_LOAD
+  glUtilLoadPrograms(programLoads, sizeof(programLoads) / sizeof(programLoads[0]));
+
+  int programIndex = 0;
+#define PROGRAM_ASSIGN(name, vs, fs, include)                      \
+  renderer->program_##name = programLoads[programIndex++].program; \
   VERIFY_OBJECT(renderer->program_##name);
 
   PROGRAMLIST(PROGRAM_ASSIGN);
 #undef PROGRAM_ASSIGN
-#define UNIFORM_ASSIGN(o, u) \
-  renderer->u##_##o = glGetUniformLocation(renderer->program_##u, #o);
+#ifdef GL_UTIL_COMPUTE
+  renderer->computeSupported = GLEW_VERSION_4_3;
+  if (renderer->computeSupported) {
+#  define COMPUTE_LOAD(name, cs) {nullptr, nullptr, cs},
+    GLUtilProgramLoad computeLoads[] = {COMPUTELIST(COMPUTE_LOAD)};
+#  undef COMPUTE_LOAD
+    glUtilLoadPrograms(computeLoads, sizeof(computeLoads) / sizeof(computeLoads[0]));
+
+    int computeIndex = 0;
+#  define COMPUTE_ASSIGN(name, cs)                                                       \
+    renderer->program_##name   = computeLoads[computeIndex].program;                    \
+    renderer->computeSupported = renderer->computeSupported && !computeLoads[computeIndex++].failed;
+    COMPUTELIST(COMPUTE_ASSIGN);
+#  undef COMPUTE_ASSIGN
+  }
+  LOG("[RENDERER] Compute programs %s\n", renderer->computeSupported ? "enabled" : "not available");
+#endif
 
-  UNIFORMLIST(UNIFORM_ASSIGN)
-#undef UNIFORM_ASSIGN
+  rendererUniforms(renderer);
+
+  if (desc.shader_reload_enable) {
+    auto reloaded = [renderer]() { rendererUniforms(renderer); };
+#define PROGRAM_WATCH(name, vs, fs, include) glUtilWatchProgram(&renderer->program_##name, programLoads[programIndex++], reloaded);
+    programIndex = 0;
+    PROGRAMLIST(PROGRAM_WATCH);
+#undef PROGRAM_WATCH
+#ifdef GL_UTIL_COMPUTE
+    if (renderer->computeSupported) {
+      GLUtilProgramLoad load;
+#  define COMPUTE_WATCH(name, path) \
+    load.cs = path;                  \
+    glUtilWatchProgram(&renderer->program_##name, load, reloaded);
+      COMPUTELIST(COMPUTE_WATCH);
+#  undef COMPUTE_WATCH
+    }
+#endif
+  }
 
   LOG("[Renderer] Render create completed.\n");
   return renderer;
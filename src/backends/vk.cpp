@@ -22,8 +22,6 @@ namespace NextVideo {
 static const char* engineName      = "No engine";
 static const char* applicationName = "Test application";
 
-ENGINE_API const char* readFile(const char* path);
-
 static VkFormat gDefaultWriteFormat;
 static VkFormat gDefaultDepthWriteFormat;
 
@@ -31,8 +29,9 @@ struct VKRenderer : public IRenderer {
 
   struct IO {
     struct buffer {
-      char*         data;
-      unsigned long count;
+      const char*   data  = nullptr;
+      unsigned long count = 0;
+      FileView      file; // Keeps data mapped
     };
   };
 
@@ -45,9 +44,9 @@ struct VKRenderer : public IRenderer {
   ptr<T> make_ptr(Args&&... args) { return std::make_unique<T>(std::forward<Args>(args)...); }
 
   ENGINE_API IO::buffer IO_readFile(const char* path) {
-    const char* data = readFile(path);
-    VERIFY(data != nullptr, "[IO] Error reading data\n");
-    return {(char*)data, strlen(data)};
+    FileView file = fileView(path);
+    VERIFY(file, "[IO] Error reading data\n");
+    return {file.data, file.size, file};
   }
 
   /* VK Util */
@@ -986,6 +985,14 @@ struct VKRenderer : public IRenderer {
 
   virtual void render(Scene* scene) override {}
   virtual void upload(Scene* scene) override {}
+  // Multiple views are not implemented on Vulkan yet, the regular path
+  // renders the current camera instead
+  virtual void renderViews(Scene* scene, const View* views, int count) override {
+    static bool reported = false;
+    if (!reported) ERROR("[VK] renderViews not implemented, rendering %d views as one\n", count);
+    reported = true;
+    render(scene);
+  }
 
   private:
   Surface*               mMainSurface = nullptr;
@@ -0,0 +1,26 @@
+#include <video.hpp>
+#include <linear.hpp>
+
+namespace NextVideo {
+
+ENGINE_API void Camera::update() {
+  view = glm::lookAt(position, position + direction, up);
+  if (orthoSize > 0.0f) proj = glm::ortho(-orthoSize * ra, orthoSize * ra, -orthoSize, orthoSize, zNear, zFar);
+  else proj = glm::perspective(fov, ra, zNear, zFar);
+
+  // Translating clip space by jitter * w moves every vertex by jitter in NDC
+  if (jitter != glm::vec2(0.0f)) proj = glm::translate(glm::mat4(1.0f), glm::vec3(jitter, 0.0f)) * proj;
+
+  viewProj = proj * view;
+  lin::frustumPlanes(viewProj, planes);
+}
+
+ENGINE_API Camera Stage::camera(float ra) const {
+  Camera camera;
+  camera.position  = camPos;
+  camera.direction = camDir;
+  camera.ra        = ra;
+  camera.update();
+  return camera;
+}
+} // namespace NextVideo
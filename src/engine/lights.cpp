@@ -0,0 +1,225 @@
+#include <video.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <thread>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+// Below this many visible point lights binning stays on the calling thread
+#define LIGHT_GRID_PARALLEL_MIN 256
+
+namespace NextVideo {
+
+#ifdef __SSE2__
+// Four lights per iteration: the sphere is tested against the six planes and
+// its center moved to view space with the light positions in SoA lanes.
+// Padding lanes and non point lights get a radius that always fails a plane.
+static void lightCull(LightGrid* grid, const Light* lights, int count, const Camera& camera) {
+  const glm::mat4& v = camera.view;
+  grid->binned.clear();
+  grid->centers.clear();
+
+  for (int i = 0; i < count; i += 4) {
+    float x[4] = {}, y[4] = {}, z[4] = {}, r[4];
+    for (int l = 0; l < 4; l++) {
+      bool point = i + l < count && lights[i + l].type == POINT;
+      r[l]       = point ? lights[i + l].radius : -FLT_MAX;
+      if (!point) continue;
+      x[l] = lights[i + l].position.x;
+      y[l] = lights[i + l].position.y;
+      z[l] = lights[i + l].position.z;
+    }
+
+    __m128 px = _mm_loadu_ps(x), py = _mm_loadu_ps(y), pz = _mm_loadu_ps(z);
+    __m128 nr      = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(r));
+    __m128 outside = _mm_setzero_ps();
+    for (int p = 0; p < 6; p++) {
+      const glm::vec4& plane = camera.planes[p];
+      __m128           d     = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), px), _mm_mul_ps(_mm_set1_ps(plane.y), py)),
+                                          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), pz), _mm_set1_ps(plane.w)));
+      outside                = _mm_or_ps(outside, _mm_cmplt_ps(d, nr));
+    }
+    int mask = _mm_movemask_ps(outside);
+    if (mask == 0xf) continue;
+
+    float c[3][4];
+    for (int row = 0; row < 3; row++) {
+      __m128 t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(v[0][row]), px), _mm_mul_ps(_mm_set1_ps(v[1][row]), py)),
+                            _mm_add_ps(_mm_mul_ps(_mm_set1_ps(v[2][row]), pz), _mm_set1_ps(v[3][row])));
+      _mm_storeu_ps(c[row], t);
+    }
+    for (int l = 0; l < 4; l++) {
+      if (mask & (1 << l)) continue;
+      grid->binned.push_back(i + l);
+      grid->centers.push_back(glm::vec3(c[0][l], c[1][l], c[2][l]));
+    }
+  }
+}
+#else
+static void lightCull(LightGrid* grid, const Light* lights, int count, const Camera& camera) {
+  grid->binned.clear();
+  grid->centers.clear();
+  for (int i = 0; i < count; i++) {
+    if (lights[i].type != POINT) continue;
+    bool inside = true;
+    for (int p = 0; p < 6 && inside; p++) inside = glm::dot(glm::vec3(camera.planes[p]), lights[i].position) + camera.planes[p].w >= -lights[i].radius;
+    if (!inside) continue;
+    grid->binned.push_back(i);
+    grid->centers.push_back(glm::vec3(camera.view * glm::vec4(lights[i].position, 1.0f)));
+  }
+}
+#endif
+
+// Conservative NDC range of x / -z over a view space box with z < 0. For
+// perspective views the extremes are at the nearest or farthest depth
+// depending on the sign of x.
+static void lightProjectRange(float xMin, float xMax, float zNear, float zFar, float scale, float offset, bool ortho, float* outMin, float* outMax) {
+  if (ortho) {
+    *outMin = xMin * scale + offset;
+    *outMax = xMax * scale + offset;
+    return;
+  }
+  *outMin = xMin / (xMin < 0.0f ? zNear : zFar) * scale + offset;
+  *outMax = xMax / (xMax > 0.0f ? zNear : zFar) * scale + offset;
+}
+
+// Tile rectangle covered by a sphere with view space center c, x1 < x0 when
+// it projects outside the view
+static glm::ivec4 lightTileRect(const LightGrid* grid, glm::vec3 c, float r, const Camera& camera, int width, int height) {
+  const glm::ivec4 culled(0, 0, -1, -1);
+  const glm::ivec4 full(0, 0, grid->tilesX - 1, grid->tilesY - 1);
+
+  // Distances in front of the camera, the sphere crossing the near plane
+  // projects to infinity so it takes the whole view
+  float zNear = -(c.z + r);
+  float zFar  = -(c.z - r);
+  bool  ortho = camera.orthoSize > 0.0f;
+  if (!ortho && zNear <= camera.zNear) return full;
+
+  // Perspective projections map x to (P00 x + P20 z) / -z, ortho to P00 x + P30
+  float offsetX = ortho ? camera.proj[3][0] : -camera.proj[2][0];
+  float offsetY = ortho ? camera.proj[3][1] : -camera.proj[2][1];
+  float x0, x1, y0, y1;
+  lightProjectRange(c.x - r, c.x + r, zNear, zFar, camera.proj[0][0], offsetX, ortho, &x0, &x1);
+  lightProjectRange(c.y - r, c.y + r, zNear, zFar, camera.proj[1][1], offsetY, ortho, &y0, &y1);
+
+  if (x1 < -1.0f || y1 < -1.0f || x0 > 1.0f || y0 > 1.0f) return culled;
+
+  glm::ivec4 rect;
+  rect.x = int((std::max(x0, -1.0f) * 0.5f + 0.5f) * width) / grid->tileSize;
+  rect.y = int((std::max(y0, -1.0f) * 0.5f + 0.5f) * height) / grid->tileSize;
+  rect.z = std::min(int((std::min(x1, 1.0f) * 0.5f + 0.5f) * width) / grid->tileSize, full.z);
+  rect.w = std::min(int((std::min(y1, 1.0f) * 0.5f + 0.5f) * height) / grid->tileSize, full.w);
+  return rect;
+}
+
+static int lightSlice(const LightGrid* grid, float depth) {
+  if (grid->slices == 1) return 0;
+  int slice = int(std::floor(std::log(std::max(depth, FLT_MIN)) * grid->sliceScale + grid->sliceBias));
+  return std::min(std::max(slice, 0), grid->slices - 1);
+}
+
+// Counts (fill false) or writes (fill true) the lights of every cluster in
+// [sliceBegin, sliceEnd). Clusters are laid out slice by slice, so threads
+// owning disjoint slice ranges never touch the same cluster.
+static void lightBinSlices(LightGrid* grid, int sliceBegin, int sliceEnd, bool fill) {
+  const int sliceSize = grid->tilesX * grid->tilesY;
+  for (int b = 0; b < grid->binned.size(); b++) {
+    const glm::ivec4& rect = grid->rects[b];
+    const int         z0   = std::max(grid->depths[b].x, sliceBegin);
+    const int         z1   = std::min(grid->depths[b].y, sliceEnd - 1);
+    for (int z = z0; z <= z1; z++) {
+      for (int y = rect.y; y <= rect.w; y++) {
+        int* cluster = &grid->tiles[(z * sliceSize + y * grid->tilesX + rect.x) * 2];
+        for (int x = rect.x; x <= rect.z; x++, cluster += 2) {
+          if (fill) grid->indices[cluster[0] + cluster[1]] = grid->binned[b];
+          cluster[1]++;
+        }
+      }
+    }
+  }
+}
+
+// Turns the counts of a slice range into offsets from 0, returns the total
+static int lightSliceOffsets(LightGrid* grid, int sliceBegin, int sliceEnd) {
+  const int sliceSize = grid->tilesX * grid->tilesY;
+  int       offset    = 0;
+  for (int c = sliceBegin * sliceSize; c < sliceEnd * sliceSize; c++) {
+    grid->tiles[c * 2] = offset;
+    offset += grid->tiles[c * 2 + 1];
+    grid->tiles[c * 2 + 1] = 0;
+  }
+  return offset;
+}
+
+// Counting sort split by slices: every thread counts its clusters and makes
+// local offsets, the first thread places the ranges one after another once
+// all counts are in, and every thread then writes its own indices
+ENGINE_API void lightGridBuild(LightGrid* grid, const Light* lights, int count, const Camera& camera, int width, int height) {
+  // Orthographic views keep every light in the first slice
+  const bool perspective = camera.orthoSize <= 0.0f && camera.zNear > 0.0f;
+  grid->tilesX     = (width + grid->tileSize - 1) / grid->tileSize;
+  grid->tilesY     = (height + grid->tileSize - 1) / grid->tileSize;
+  grid->sliceScale = perspective ? grid->slices / std::log(camera.zFar / camera.zNear) : 0.0f;
+  grid->sliceBias  = perspective ? -std::log(camera.zNear) * grid->sliceScale : 0.0f;
+  grid->tiles.assign(grid->tilesX * grid->tilesY * grid->slices * 2, 0);
+
+  grid->globalCount = 0;
+  for (int i = 0; i < count; i++) grid->globalCount += lights[i].type != POINT;
+
+  lightCull(grid, lights, count, camera);
+  grid->rects.resize(grid->binned.size());
+  grid->depths.resize(grid->binned.size());
+  for (int b = 0; b < grid->binned.size(); b++) {
+    const glm::vec3& c = grid->centers[b];
+    const float      r = lights[grid->binned[b]].radius;
+    grid->rects[b]     = lightTileRect(grid, c, r, camera, width, height);
+    grid->depths[b]    = glm::ivec2(lightSlice(grid, -(c.z + r)), lightSlice(grid, -(c.z - r)));
+  }
+
+  int threads = grid->threads > 0 ? grid->threads : std::thread::hardware_concurrency();
+  threads     = std::max(1, std::min(threads, grid->slices));
+  if (grid->binned.size() < LIGHT_GRID_PARALLEL_MIN) threads = 1;
+
+  std::vector<int>  bases(threads);
+  std::atomic<int>  counted(0);
+  std::atomic<bool> ready(false);
+
+  auto work = [&](int t) {
+    const int begin = grid->slices * t / threads;
+    const int end   = grid->slices * (t + 1) / threads;
+    lightBinSlices(grid, begin, end, false);
+    bases[t] = lightSliceOffsets(grid, begin, end);
+    counted++;
+
+    if (t == 0) {
+      while (counted.load() < threads) std::this_thread::yield();
+      int offset = grid->globalCount;
+      for (int i = 0; i < threads; i++) {
+        int total = bases[i];
+        bases[i]  = offset;
+        offset += total;
+      }
+      grid->indices.resize(offset);
+      for (int i = 0, g = 0; i < count; i++) {
+        if (lights[i].type != POINT) grid->indices[g++] = i;
+      }
+      ready = true;
+    } else {
+      while (!ready.load()) std::this_thread::yield();
+    }
+
+    const int sliceSize = grid->tilesX * grid->tilesY;
+    for (int c = begin * sliceSize; c < end * sliceSize; c++) grid->tiles[c * 2] += bases[t];
+    lightBinSlices(grid, begin, end, true);
+  };
+
+  std::vector<std::thread> workers;
+  for (int t = 1; t < threads; t++) workers.emplace_back(work, t);
+  work(0);
+  for (std::thread& worker : workers) worker.join();
+}
+} // namespace NextVideo
@@ -0,0 +1,223 @@
+#include <linear.hpp>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+namespace lin {
+ENGINE_API void frustumPlanes(const glm::mat4& m, glm::vec4* planes) {
+  glm::vec4 r0(m[0][0], m[1][0], m[2][0], m[3][0]);
+  glm::vec4 r1(m[0][1], m[1][1], m[2][1], m[3][1]);
+  glm::vec4 r2(m[0][2], m[1][2], m[2][2], m[3][2]);
+  glm::vec4 r3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+  planes[0] = r3 + r0;
+  planes[1] = r3 - r0;
+  planes[2] = r3 + r1;
+  planes[3] = r3 - r1;
+  planes[4] = r3 + r2;
+  planes[5] = r3 - r2;
+  for (int i = 0; i < 6; i++) planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+#ifdef __SSE2__
+// Every kernel loads glm columns as whole registers, a glm::mat4 is 16
+// contiguous floats and a glm::vec4 column is 4 of them
+static inline __m128 col(const glm::mat4& m, int i) { return _mm_loadu_ps(&m[i][0]); }
+
+static inline __m128 combine(__m128 c0, __m128 c1, __m128 c2, __m128 c3, const float* v) {
+  __m128 r = _mm_mul_ps(c0, _mm_set1_ps(v[0]));
+  r        = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(v[1])));
+  r        = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(v[2])));
+  return _mm_add_ps(r, _mm_mul_ps(c3, _mm_set1_ps(v[3])));
+}
+
+static inline __m128 cross(__m128 a, __m128 b) {
+  __m128 a1 = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+  __m128 b1 = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+  __m128 c  = _mm_sub_ps(_mm_mul_ps(a, b1), _mm_mul_ps(a1, b));
+  return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+static inline float dot3(__m128 a, __m128 b) {
+  float v[4];
+  _mm_storeu_ps(v, _mm_mul_ps(a, b));
+  return v[0] + v[1] + v[2];
+}
+
+static inline void store3(float* out, __m128 v) {
+  float t[4];
+  _mm_storeu_ps(t, v);
+  out[0] = t[0];
+  out[1] = t[1];
+  out[2] = t[2];
+}
+
+// Cofactor columns of the upper 3x3 divided by the determinant, that is the
+// columns of the normal matrix and the rows of the inverse rotation
+static inline void cofactors(const glm::mat4& m, __m128* n0, __m128* n1, __m128* n2) {
+  __m128 c0  = col(m, 0);
+  __m128 c1  = col(m, 1);
+  __m128 c2  = col(m, 2);
+  __m128 x0  = cross(c1, c2);
+  __m128 inv = _mm_set1_ps(1.0f / dot3(c0, x0));
+  *n0        = _mm_mul_ps(x0, inv);
+  *n1        = _mm_mul_ps(cross(c2, c0), inv);
+  *n2        = _mm_mul_ps(cross(c0, c1), inv);
+}
+
+ENGINE_API void mul(const glm::mat4& a, const glm::mat4* b, glm::mat4* out, int count) {
+  __m128 a0 = col(a, 0), a1 = col(a, 1), a2 = col(a, 2), a3 = col(a, 3);
+  for (int i = 0; i < count; i++) {
+    __m128 r[4];
+    for (int j = 0; j < 4; j++) r[j] = combine(a0, a1, a2, a3, &b[i][j][0]);
+    for (int j = 0; j < 4; j++) _mm_storeu_ps(&out[i][j][0], r[j]);
+  }
+}
+
+ENGINE_API void mul(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, int count) {
+  for (int i = 0; i < count; i++) {
+    __m128 a0 = col(a[i], 0), a1 = col(a[i], 1), a2 = col(a[i], 2), a3 = col(a[i], 3);
+    __m128 r[4];
+    for (int j = 0; j < 4; j++) r[j] = combine(a0, a1, a2, a3, &b[i][j][0]);
+    for (int j = 0; j < 4; j++) _mm_storeu_ps(&out[i][j][0], r[j]);
+  }
+}
+
+ENGINE_API void transformPoints(const glm::mat4& m, const glm::vec3* points, glm::vec3* out, int count) {
+  __m128 c0 = col(m, 0), c1 = col(m, 1), c2 = col(m, 2), c3 = col(m, 3);
+  for (int i = 0; i < count; i++) {
+    __m128 r = _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(points[i].x)), c3);
+    r        = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(points[i].y)));
+    r        = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(points[i].z)));
+    store3(&out[i].x, r);
+  }
+}
+
+// Center and half extent form: the center is transformed as a point and the
+// extent by the absolute value of the rotation and scale part
+ENGINE_API void transformAABB(const glm::mat4* m, const AABB& box, AABB* out, int count) {
+  const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  glm::vec3    center  = (box.min + box.max) * 0.5f;
+  glm::vec3    extent  = (box.max - box.min) * 0.5f;
+  __m128       cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+  __m128       ex = _mm_set1_ps(extent.x), ey = _mm_set1_ps(extent.y), ez = _mm_set1_ps(extent.z);
+
+  for (int i = 0; i < count; i++) {
+    __m128 c0 = col(m[i], 0), c1 = col(m[i], 1), c2 = col(m[i], 2), c3 = col(m[i], 3);
+    __m128 c  = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, cx), _mm_mul_ps(c1, cy)), _mm_add_ps(_mm_mul_ps(c2, cz), c3));
+    __m128 e  = _mm_mul_ps(_mm_and_ps(c0, absMask), ex);
+    e         = _mm_add_ps(e, _mm_mul_ps(_mm_and_ps(c1, absMask), ey));
+    e         = _mm_add_ps(e, _mm_mul_ps(_mm_and_ps(c2, absMask), ez));
+    store3(&out[i].min.x, _mm_sub_ps(c, e));
+    store3(&out[i].max.x, _mm_add_ps(c, e));
+  }
+}
+
+ENGINE_API void inverseAffine(const glm::mat4* m, glm::mat4* out, int count) {
+  for (int i = 0; i < count; i++) {
+    __m128 r0, r1, r2;
+    cofactors(m[i], &r0, &r1, &r2);
+    const float* t = &m[i][3][0];
+
+    // The cofactor vectors are the rows of the inverse, transpose into columns
+    __m128 r3 = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    __m128 it = _mm_sub_ps(_mm_setzero_ps(), combine(r0, r1, r2, _mm_setzero_ps(), t));
+    _mm_storeu_ps(&out[i][0][0], r0);
+    _mm_storeu_ps(&out[i][1][0], r1);
+    _mm_storeu_ps(&out[i][2][0], r2);
+    _mm_storeu_ps(&out[i][3][0], it);
+    out[i][3][3] = 1.0f;
+  }
+}
+
+// Planes are transposed into two groups of four lanes, the last two lanes
+// hold a plane every box passes. A box is outside a plane when its center
+// distance plus the extent projected on the plane normal is negative.
+ENGINE_API void cullAABB(const glm::vec4* planes, const AABB* boxes, unsigned char* visible, int count) {
+  const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  float        soa[4][8];
+  for (int i = 0; i < 8; i++) {
+    glm::vec4 p = i < 6 ? planes[i] : glm::vec4(0, 0, 0, 1);
+    for (int c = 0; c < 4; c++) soa[c][i] = p[c];
+  }
+
+  __m128 px[2], py[2], pz[2], pw[2], ax[2], ay[2], az[2];
+  for (int g = 0; g < 2; g++) {
+    px[g] = _mm_loadu_ps(&soa[0][g * 4]);
+    py[g] = _mm_loadu_ps(&soa[1][g * 4]);
+    pz[g] = _mm_loadu_ps(&soa[2][g * 4]);
+    pw[g] = _mm_loadu_ps(&soa[3][g * 4]);
+    ax[g] = _mm_and_ps(px[g], absMask);
+    ay[g] = _mm_and_ps(py[g], absMask);
+    az[g] = _mm_and_ps(pz[g], absMask);
+  }
+
+  for (int i = 0; i < count; i++) {
+    const AABB& b  = boxes[i];
+    __m128      cx = _mm_set1_ps((b.min.x + b.max.x) * 0.5f), ex = _mm_set1_ps((b.max.x - b.min.x) * 0.5f);
+    __m128      cy = _mm_set1_ps((b.min.y + b.max.y) * 0.5f), ey = _mm_set1_ps((b.max.y - b.min.y) * 0.5f);
+    __m128      cz = _mm_set1_ps((b.min.z + b.max.z) * 0.5f), ez = _mm_set1_ps((b.max.z - b.min.z) * 0.5f);
+
+    int outside = 0;
+    for (int g = 0; g < 2; g++) {
+      __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px[g], cx), _mm_mul_ps(py[g], cy)), _mm_add_ps(_mm_mul_ps(pz[g], cz), pw[g]));
+      __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[g], ex), _mm_mul_ps(ay[g], ey)), _mm_mul_ps(az[g], ez));
+      outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+    }
+    visible[i] = outside == 0;
+  }
+}
+
+ENGINE_API void normalMatrix(const glm::mat4* m, glm::mat3* out, int count) {
+  for (int i = 0; i < count; i++) {
+    __m128 n0, n1, n2;
+    cofactors(m[i], &n0, &n1, &n2);
+    store3(&out[i][0][0], n0);
+    store3(&out[i][1][0], n1);
+    store3(&out[i][2][0], n2);
+  }
+}
+#else
+ENGINE_API void mul(const glm::mat4& a, const glm::mat4* b, glm::mat4* out, int count) {
+  for (int i = 0; i < count; i++) out[i] = a * b[i];
+}
+
+ENGINE_API void mul(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, int count) {
+  for (int i = 0; i < count; i++) out[i] = a[i] * b[i];
+}
+
+ENGINE_API void transformPoints(const glm::mat4& m, const glm::vec3* points, glm::vec3* out, int count) {
+  for (int i = 0; i < count; i++) out[i] = glm::vec3(m * glm::vec4(points[i], 1.0f));
+}
+
+ENGINE_API void transformAABB(const glm::mat4* m, const AABB& box, AABB* out, int count) {
+  glm::vec3 center = (box.min + box.max) * 0.5f;
+  glm::vec3 extent = (box.max - box.min) * 0.5f;
+  for (int i = 0; i < count; i++) {
+    glm::vec3 c = glm::vec3(m[i] * glm::vec4(center, 1.0f));
+    glm::vec3 e = glm::abs(glm::vec3(m[i][0])) * extent.x + glm::abs(glm::vec3(m[i][1])) * extent.y + glm::abs(glm::vec3(m[i][2])) * extent.z;
+    out[i].min  = c - e;
+    out[i].max  = c + e;
+  }
+}
+
+ENGINE_API void inverseAffine(const glm::mat4* m, glm::mat4* out, int count) {
+  for (int i = 0; i < count; i++) out[i] = glm::inverse(m[i]);
+}
+
+ENGINE_API void normalMatrix(const glm::mat4* m, glm::mat3* out, int count) {
+  for (int i = 0; i < count; i++) out[i] = glm::transpose(glm::inverse(glm::mat3(m[i])));
+}
+
+ENGINE_API void cullAABB(const glm::vec4* planes, const AABB* boxes, unsigned char* visible, int count) {
+  for (int i = 0; i < count; i++) {
+    glm::vec3 c = (boxes[i].min + boxes[i].max) * 0.5f;
+    glm::vec3 e = (boxes[i].max - boxes[i].min) * 0.5f;
+    bool      v = true;
+    for (int p = 0; p < 6 && v; p++) v = glm::dot(glm::vec3(planes[p]), c) + planes[p].w + glm::dot(glm::abs(glm::vec3(planes[p])), e) >= 0.0f;
+    visible[i] = v;
+  }
+}
+#endif
+} // namespace lin
@@ -0,0 +1,96 @@
+#include <video.hpp>
+#include <algorithm>
+
+namespace NextVideo {
+
+ENGINE_API void RenderGraph::clear() {
+  targets.clear();
+  passes.clear();
+  physical.clear();
+}
+
+ENGINE_API int RenderGraph::target(const char* name, RenderGraphFormat format, glm::ivec2 size) {
+  VERIFY(size.x > 0 && size.y > 0, "Invalid size %dx%d for render graph target %s\n", size.x, size.y, name);
+  RenderGraphTarget target;
+  target.name   = name;
+  target.format = format;
+  target.size   = size;
+  targets.push_back(target);
+  return targets.size() - 1;
+}
+
+ENGINE_API int RenderGraph::pass(const char* name, std::function<void()> execute, bool output) {
+  RenderGraphPass pass;
+  pass.name    = name;
+  pass.execute = std::move(execute);
+  pass.output  = output;
+  passes.push_back(std::move(pass));
+  return passes.size() - 1;
+}
+
+ENGINE_API void RenderGraph::read(int pass, int target) {
+  VERIFY(valid(passes, pass) && valid(targets, target), "Invalid render graph read\n");
+  passes[pass].reads.push_back(target);
+}
+
+ENGINE_API void RenderGraph::write(int pass, int target) {
+  VERIFY(valid(passes, pass) && valid(targets, target), "Invalid render graph write\n");
+  passes[pass].writes.push_back(target);
+}
+
+ENGINE_API void RenderGraph::compile() {
+  physical.clear();
+  for (RenderGraphTarget& target : targets) {
+    target.first    = -1;
+    target.last     = -1;
+    target.physical = -1;
+  }
+
+  // Backwards, a pass survives when it draws outside the graph or a later
+  // surviving pass reads something it writes. Its writes satisfy those reads,
+  // so earlier writers of the same target are only kept if it reads it too.
+  std::vector<bool> needed(targets.size(), false);
+  for (int p = passes.size() - 1; p >= 0; p--) {
+    RenderGraphPass& pass = passes[p];
+    bool             live = pass.output;
+    for (int t : pass.writes) live = live || needed[t];
+    pass.culled = !live;
+    if (!live) continue;
+    for (int t : pass.writes) needed[t] = false;
+    for (int t : pass.reads) needed[t] = true;
+  }
+
+  for (int p = 0; p < passes.size(); p++) {
+    if (passes[p].culled) continue;
+    for (int t : passes[p].reads) {
+      VERIFY(targets[t].first >= 0, "Render graph pass %s reads %s before it is written\n", passes[p].name, targets[t].name);
+      targets[t].last = p;
+    }
+    for (int t : passes[p].writes) {
+      if (targets[t].first < 0) targets[t].first = p;
+      targets[t].last = p;
+    }
+  }
+
+  // Greedy interval packing in order of first use
+  std::vector<int> order;
+  for (int t = 0; t < targets.size(); t++) {
+    if (targets[t].first >= 0) order.push_back(t);
+  }
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return targets[a].first < targets[b].first; });
+
+  std::vector<int> busyUntil;
+  for (int t : order) {
+    RenderGraphTarget& target = targets[t];
+    for (int i = 0; i < physical.size() && target.physical < 0; i++) {
+      if (physical[i].format == target.format && physical[i].size == target.size && busyUntil[i] < target.first) target.physical = i;
+    }
+    if (target.physical < 0) {
+      target.physical = physical.size();
+      physical.push_back({target.format, target.size});
+      busyUntil.push_back(0);
+    }
+    busyUntil[target.physical] = target.last;
+  }
+}
+} // namespace NextVideo
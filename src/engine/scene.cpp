@@ -8,8 +8,9 @@
 #include "linear.hpp"
 namespace NextVideo {
 int Scene::addTexture(const char* path) {
-  Texture text;
-  text.data = stbi_load(path, &text.width, &text.height, &text.channels, 3);
+  Texture  text;
+  FileView file = fileView(path);
+  text.data     = file ? stbi_load_from_memory((const stbi_uc*)file.data, file.size, &text.width, &text.height, &text.channels, 3) : nullptr;
   VERIFY(text.data != nullptr, "[IO] Error trying to load texture %s\n", path);
   textures.push_back(text);
   return textures.size() - 1;
@@ -1,46 +1,424 @@
 #include <video.hpp>
-#include <fstream>
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef __EMSCRIPTEN__
+#  include <sys/mman.h>
+#  include <sys/uio.h>
+#endif
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#  include <linux/io_uring.h>
+#  include <sys/syscall.h>
+#  define FILE_IO_URING 1
+#endif
+
+// Bytes of files no view holds anymore that stay mapped
+#define FILE_CACHE_BUDGET (64 << 20)
+// Smaller files are copied to the heap instead of mapped
+#define FILE_MAP_MIN (64 << 10)
+// Reads in flight on the ring, or workers when io_uring is not available
+#define FILE_IO_RING_ENTRIES 64
+#define FILE_IO_THREADS      4
+
 namespace NextVideo {
 
-#ifdef __EMSCRIPTEN__
+/* File views */
+// Every cache entry holds one reference to its mapping, so recently used files
+// stay mapped with no view open. Entries are checked against the inode, size
+// and modification time of the file on every open, a file changed on disk is
+// read again. Views of a heap copy keep the old contents; a mapping is shared
+// with the page cache, so a file rewritten in place shows through its old
+// views and one truncated raises SIGBUS past the new end. Replacing the file
+// by renaming a new one over it leaves old mappings untouched.
+struct FileMapping {
+  const char* data = nullptr;
+  size_t      size = 0;
+  bool        heap = false;
 
-const char* readFile(const char* path) {
+  ~FileMapping() {
+#ifndef __EMSCRIPTEN__
+    if (!heap && size > 0) munmap((void*)data, size);
+#endif
+    if (heap) free((void*)data);
+  }
+};
 
-  std::ifstream file(path);
-  std::string   content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+struct FileCacheEntry {
+  std::shared_ptr<const FileMapping> mapping;
+  uint64_t                           stamp[4];
+  uint64_t                           lastUse;
+  bool                               prefetched = false; // Kept until its first view
+};
 
-  char* data = new char[content.size() + 1];
-  for (int i = 0; i < content.size(); i++) data[i] = content[i];
-  return data;
-}
+static std::mutex                                      fileCacheLock;
+static std::condition_variable                         fileCacheFetched;
+static std::unordered_map<std::string, FileCacheEntry> fileCache;
+static std::unordered_set<std::string>                 fileFetching; // Queued or being read
+static std::deque<std::string>                         fileQueue;
+static std::condition_variable                         fileQueued;
+static uint64_t                                        fileCacheClock = 0;
+
+static void fileStamp(const struct stat& st, uint64_t* stamp) {
+  stamp[0] = st.st_dev;
+  stamp[1] = st.st_ino;
+  stamp[2] = st.st_size;
+#ifdef __linux__
+  stamp[3] = uint64_t(st.st_mtim.tv_sec) * 1000000000ull + st.st_mtim.tv_nsec;
 #else
-#  include <fcntl.h>
-#  include <sys/stat.h>
-#  include <unistd.h>
-const char* readFile(const char* path) {
-  struct stat _stat;
-  stat(path, &_stat);
+  stamp[3] = st.st_mtime;
+#endif
+}
 
-  if (_stat.st_size <= 0)
-    return 0;
+// Small files, like shaders that get edited while in use, and every file on
+// Emscripten where mmap is not backed by the filesystem are read instead
+static std::shared_ptr<const FileMapping> fileMap(int fd, size_t size) {
+  static const char empty[1] = {0};
+  auto              mapping  = std::make_shared<FileMapping>();
+  if (size == 0) {
+    mapping->data = empty;
+    return mapping;
+  }
 
-  int fd = open(path, O_RDONLY);
-  if (fd < 0) {
-    return 0;
+#ifndef __EMSCRIPTEN__
+  if (size >= FILE_MAP_MIN) {
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) return nullptr;
+    mapping->data = (const char*)data;
+    mapping->size = size;
+    return mapping;
+  }
+#endif
+  char*  data    = (char*)malloc(size);
+  size_t current = 0;
+  while (current < size) {
+    ssize_t step = read(fd, data + current, size - current);
+    if (step <= 0) break;
+    current += step;
   }
+  mapping->data = data;
+  mapping->size = current;
+  mapping->heap = true;
+  if (current < size) return nullptr;
+  return mapping;
+}
 
-  char* buffer          = (char*)malloc(_stat.st_size + 1);
-  buffer[_stat.st_size] = 0;
+// Drops the least recently used entries nothing else references until the
+// rest fits in the budget
+static void fileCacheTrim() {
+  for (;;) {
+    size_t total  = 0;
+    auto   oldest = fileCache.end();
+    for (auto it = fileCache.begin(); it != fileCache.end(); ++it) {
+      if (it->second.mapping.use_count() > 1 || it->second.prefetched) continue;
+      total += it->second.mapping->size;
+      if (oldest == fileCache.end() || it->second.lastUse < oldest->second.lastUse) oldest = it;
+    }
+    if (total <= FILE_CACHE_BUDGET || oldest == fileCache.end()) return;
+    fileCache.erase(oldest);
+  }
+}
 
-  int current = 0;
-  int size    = _stat.st_size;
-  int step    = 0;
+// Called with fileCacheLock held
+static void fileCacheInsert(const std::string& path, std::shared_ptr<const FileMapping> mapping, const struct stat& st, bool prefetched) {
+  FileCacheEntry& entry = fileCache[path];
+  fileStamp(st, entry.stamp);
+  entry.mapping    = mapping;
+  entry.lastUse    = ++fileCacheClock;
+  entry.prefetched = prefetched;
+  fileCacheTrim();
+}
 
-  while ((step = read(fd, &buffer[current], size - current))) {
-    current += step;
+ENGINE_API FileView fileView(const char* path) {
+  FileView    view;
+  struct stat st;
+  uint64_t    stamp[4];
+
+  // A file still queued behind other prefetches is read right away, only a
+  // read already in flight is waited for
+  std::unique_lock<std::mutex> lock(fileCacheLock);
+  auto                         queued = std::find(fileQueue.begin(), fileQueue.end(), path);
+  if (queued != fileQueue.end()) {
+    fileQueue.erase(queued);
+    fileFetching.erase(path);
+  }
+  while (fileFetching.count(path)) fileCacheFetched.wait(lock);
+
+  auto it = fileCache.find(path);
+  if (it != fileCache.end() && stat(path, &st) == 0) {
+    fileStamp(st, stamp);
+    if (memcmp(stamp, it->second.stamp, sizeof(stamp)) == 0) {
+      it->second.lastUse    = ++fileCacheClock;
+      it->second.prefetched = false;
+      view.data             = it->second.mapping->data;
+      view.size             = it->second.mapping->size;
+      view.owner            = it->second.mapping;
+      return view;
+    }
+  }
+  lock.unlock();
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return view;
+  std::shared_ptr<const FileMapping> mapping;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) mapping = fileMap(fd, st.st_size);
+  close(fd);
+  if (mapping == nullptr) return view;
+
+  lock.lock();
+  fileCacheInsert(path, mapping, st, false);
+  view.data  = mapping->data;
+  view.size  = mapping->size;
+  view.owner = mapping;
+  return view;
+}
+
+/* Prefetch */
+// Whole files read into heap buffers ahead of their fileView calls. With
+// io_uring one thread keeps up to FILE_IO_RING_ENTRIES reads in flight and
+// only blocks on completions; without it, kernels before 5.1 or sandboxes
+// that deny io_uring_setup, FILE_IO_THREADS workers read one file each.
+struct FileRead {
+  std::string  path;
+  int          fd   = -1;
+  char*        data = nullptr;
+  size_t       done = 0;
+  struct stat  st;
+  struct iovec iov;
+};
+
+
+static FileRead* fileReadOpen(const std::string& path) {
+  FileRead* read = new FileRead();
+  read->path     = path;
+  read->fd       = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (read->fd >= 0 && fstat(read->fd, &read->st) == 0 && S_ISREG(read->st.st_mode)) {
+    read->data = (char*)malloc(read->st.st_size > 0 ? read->st.st_size : 1);
+    return read;
+  }
+  if (read->fd >= 0) close(read->fd);
+  delete read;
+  return nullptr;
+}
+
+// Called with fileCacheLock held, read may be null when the open failed
+static void fileReadPublish(const std::string& path, FileRead* read, bool ok) {
+  if (read && ok) {
+    auto mapping  = std::make_shared<FileMapping>();
+    mapping->data = read->data;
+    mapping->size = read->st.st_size;
+    mapping->heap = true;
+    fileCacheInsert(path, mapping, read->st, true);
+  } else if (read) {
+    free(read->data);
+  }
+  fileFetching.erase(path);
+  fileCacheFetched.notify_all();
+  if (read) {
+    close(read->fd);
+    delete read;
   }
+}
+
+struct FileIOThreads {
+  std::vector<std::thread> threads;
+  bool                     started = false;
+  bool                     stop    = false;
+
+  ~FileIOThreads() {
+    {
+      std::lock_guard<std::mutex> lock(fileCacheLock);
+      stop = true;
+    }
+    fileQueued.notify_all();
+    for (std::thread& thread : threads) thread.join();
+  }
+};
+static FileIOThreads fileIO;
+
+static void fileWorkerThread() {
+  std::unique_lock<std::mutex> lock(fileCacheLock);
+  for (;;) {
+    while (!fileIO.stop && fileQueue.empty()) fileQueued.wait(lock);
+    if (fileQueue.empty()) return;
+    std::string path = fileQueue.front();
+    fileQueue.pop_front();
+    lock.unlock();
+
+    FileRead* read = fileReadOpen(path);
+    bool      ok   = read != nullptr;
+    while (ok && read->done < size_t(read->st.st_size)) {
+      ssize_t step = pread(read->fd, read->data + read->done, read->st.st_size - read->done, read->done);
+      if (step < 0 && errno == EINTR) continue;
+      ok = step > 0;
+      if (ok) read->done += step;
+    }
+
+    lock.lock();
+    fileReadPublish(path, read, ok);
+  }
+}
+
+#ifdef FILE_IO_URING
+struct FileRing {
+  int                  fd = -1;
+  unsigned*            sqTail;
+  unsigned*            sqMask;
+  unsigned*            sqArray;
+  unsigned*            cqHead;
+  unsigned*            cqTail;
+  unsigned*            cqMask;
+  struct io_uring_sqe* sqes;
+  struct io_uring_cqe* cqes;
+  unsigned             entries;
+};
+
+static bool fileRingCreate(FileRing* ring) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring->fd = syscall(__NR_io_uring_setup, FILE_IO_RING_ENTRIES, &params);
+  if (ring->fd < 0) return false;
+
+  size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool   single = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single) sqSize = cqSize = std::max(sqSize, cqSize);
+
+  char* sq   = (char*)mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  char* cq   = single ? sq : (char*)mmap(nullptr, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+  void* sqes = mmap(nullptr, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+    close(ring->fd);
+    return false;
+  }
+
+  ring->sqTail  = (unsigned*)(sq + params.sq_off.tail);
+  ring->sqMask  = (unsigned*)(sq + params.sq_off.ring_mask);
+  ring->sqArray = (unsigned*)(sq + params.sq_off.array);
+  ring->cqHead  = (unsigned*)(cq + params.cq_off.head);
+  ring->cqTail  = (unsigned*)(cq + params.cq_off.tail);
+  ring->cqMask  = (unsigned*)(cq + params.cq_off.ring_mask);
+  ring->sqes    = (struct io_uring_sqe*)sqes;
+  ring->cqes    = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+  ring->entries = params.sq_entries;
+  return true;
+}
+
+// Queues the rest of the file, the ring is never fuller than entries since
+// every read has at most one request in flight
+static void fileRingRead(FileRing* ring, FileRead* read) {
+  unsigned             tail  = *ring->sqTail;
+  unsigned             index = tail & *ring->sqMask;
+  struct io_uring_sqe* sqe   = &ring->sqes[index];
+  read->iov.iov_base         = read->data + read->done;
+  read->iov.iov_len          = read->st.st_size - read->done;
 
-  return buffer;
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode          = IORING_OP_READV;
+  sqe->fd              = read->fd;
+  sqe->addr            = (uint64_t)&read->iov;
+  sqe->len             = 1;
+  sqe->off             = read->done;
+  sqe->user_data       = (uint64_t)read;
+  ring->sqArray[index] = index;
+  __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
 }
+
+static void fileRingThread(FileRing ring) {
+  int                          inFlight = 0;
+  unsigned                     pending  = 0; // Queued on the ring but not yet submitted
+  std::vector<FileRead*>       finished;
+  std::vector<bool>            finishedOk;
+  std::unique_lock<std::mutex> lock(fileCacheLock);
+  for (;;) {
+    while (!fileIO.stop && fileQueue.empty() && inFlight == 0) fileQueued.wait(lock);
+    if (fileIO.stop && inFlight == 0) break;
+
+    std::vector<std::string> paths;
+    while (!fileQueue.empty() && inFlight + paths.size() < ring.entries) {
+      paths.push_back(fileQueue.front());
+      fileQueue.pop_front();
+    }
+    lock.unlock();
+
+    std::vector<std::string> failed;
+    for (const std::string& path : paths) {
+      FileRead* read = fileReadOpen(path);
+      if (read == nullptr) failed.push_back(path);
+      else if (read->st.st_size == 0) {
+        finished.push_back(read);
+        finishedOk.push_back(true);
+      } else {
+        fileRingRead(&ring, read);
+        pending++;
+        inFlight++;
+      }
+    }
+
+    if (inFlight > 0) {
+      int submitted = syscall(__NR_io_uring_enter, ring.fd, pending, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (submitted > 0) pending -= submitted;
+    }
+
+    unsigned head = *ring.cqHead;
+    unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      struct io_uring_cqe* cqe  = &ring.cqes[head & *ring.cqMask];
+      FileRead*            read = (FileRead*)cqe->user_data;
+      bool                 retry = cqe->res == -EINTR || cqe->res == -EAGAIN;
+      if (cqe->res > 0) read->done += cqe->res;
+
+      if ((cqe->res > 0 || retry) && read->done < size_t(read->st.st_size)) {
+        fileRingRead(&ring, read);
+        pending++;
+        continue;
+      }
+      finished.push_back(read);
+      finishedOk.push_back(read->done == size_t(read->st.st_size));
+      inFlight--;
+    }
+    __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+
+    lock.lock();
+    for (const std::string& path : failed) fileReadPublish(path, nullptr, false);
+    for (size_t i = 0; i < finished.size(); i++) fileReadPublish(finished[i]->path, finished[i], finishedOk[i]);
+    finished.clear();
+    finishedOk.clear();
+  }
+  close(ring.fd);
+}
+#endif
+
+// Called with fileCacheLock held
+static void fileIOStart() {
+  fileIO.started = true;
+#ifdef FILE_IO_URING
+  FileRing ring;
+  if (fileRingCreate(&ring)) {
+    LOG("[IO] Prefetching through io_uring\n");
+    fileIO.threads.emplace_back(fileRingThread, ring);
+    return;
+  }
 #endif
+  LOG("[IO] Prefetching with %d threads\n", FILE_IO_THREADS);
+  for (int i = 0; i < FILE_IO_THREADS; i++) fileIO.threads.emplace_back(fileWorkerThread);
+}
+
+ENGINE_API void filePrefetch(const char* path) {
+#ifndef __EMSCRIPTEN__
+  std::lock_guard<std::mutex> lock(fileCacheLock);
+  if (fileCache.count(path) || !fileFetching.insert(path).second) return;
+  if (!fileIO.started) fileIOStart();
+  fileQueue.push_back(path);
+  fileQueued.notify_one();
+#endif
+}
 } // namespace NextVideo
@@ -1,7 +1,14 @@
 #include "../engine/engine.hpp"
 #include <assimp/Importer.hpp>
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <cctype>
+#include <cstring>
+#include <string_view>
+#include <strings.h>
+#include <unistd.h>
 #include "../engine/linear.hpp"
 
 namespace NextVideo {
@@ -20,6 +27,85 @@ struct LoaderCache {
 };
 
 LoaderCache    cache;
+
+// Assimp reads the model and the files it references, such as .mtl
+// libraries, from file views instead of its own stdio buffers
+struct FileViewStream : public Assimp::IOStream {
+  FileView file;
+  size_t   position = 0;
+
+  FileViewStream(FileView file) : file(file) {}
+
+  size_t Read(void* buffer, size_t size, size_t count) override {
+    if (size == 0) return 0;
+    count = std::min(count, (file.size - position) / size);
+    memcpy(buffer, file.data + position, size * count);
+    position += size * count;
+    return count;
+  }
+  size_t   Write(const void* buffer, size_t size, size_t count) override { return 0; }
+  aiReturn Seek(size_t offset, aiOrigin origin) override {
+    size_t base = origin == aiOrigin_SET ? 0 : origin == aiOrigin_CUR ? position : file.size;
+    if (base + offset > file.size) return aiReturn_FAILURE;
+    position = base + offset;
+    return aiReturn_SUCCESS;
+  }
+  size_t Tell() const override { return position; }
+  size_t FileSize() const override { return file.size; }
+  void   Flush() override {}
+};
+
+// Starts reading the files an OBJ or MTL file references as soon as it is
+// opened, so they arrive while Assimp parses. Material libraries resolve
+// next to the model like Assimp does; only the texture slots
+// materialTextures uses are fetched, since a prefetched file stays cached
+// until it is viewed.
+static void prefetchReferences(const char* path, const FileView& file) {
+  const char* extension = strrchr(path, '.');
+  const bool  obj       = extension && strcasecmp(extension, ".obj") == 0;
+  const bool  mtl       = extension && strcasecmp(extension, ".mtl") == 0;
+  if (!obj && !mtl) return;
+
+  const char*      slash = strrchr(path, '/');
+  std::string      directory(path, slash ? slash + 1 - path : 0);
+  std::string_view text = file.str();
+  for (size_t begin = 0; begin < text.size();) {
+    size_t end = text.find('\n', begin);
+    if (end == std::string_view::npos) end = text.size();
+    std::string_view line = text.substr(begin, end - begin);
+    begin                 = end + 1;
+
+    while (!line.empty() && isspace((unsigned char)line.front())) line.remove_prefix(1);
+    while (!line.empty() && isspace((unsigned char)line.back())) line.remove_suffix(1);
+    if (obj && line.substr(0, 7) == "mtllib ") {
+      // Several libraries may share one line
+      for (size_t i = 7; i < line.size();) {
+        size_t next = std::min(line.find(' ', i), line.size());
+        if (next > i) filePrefetch((directory + std::string(line.substr(i, next - i))).c_str());
+        i = next + 1;
+      }
+    } else if (mtl && (line.substr(0, 7) == "map_Kd " || line.substr(0, 7) == "map_Ks ")) {
+      // Options such as -s come first, the path is the last token
+      filePrefetch(std::string(line.substr(line.rfind(' ') + 1)).c_str());
+    }
+  }
+}
+
+struct FileViewSystem : public Assimp::IOSystem {
+  // Assimp probes several candidate paths, a view would read and cache each
+  bool Exists(const char* path) const override { return access(path, R_OK) == 0; }
+  char getOsSeparator() const override { return '/'; }
+
+  Assimp::IOStream* Open(const char* path, const char* mode) override {
+    if (strchr(mode, 'w') || strchr(mode, 'a')) return nullptr;
+    FileView file = fileView(path);
+    if (!file) return nullptr;
+    prefetchReferences(path, file);
+    return new FileViewStream(file);
+  }
+  void Close(Assimp::IOStream* stream) override { delete stream; }
+};
+
 ENGINE_API int processTexture(const std::string& path, Scene* tracerScene) {
   auto it = cache.textureCache.find(path);
   if (it != cache.textureCache.end()) return it->second;
@@ -28,6 +114,19 @@ ENGINE_API int processTexture(const std::string& path, Scene* tracerScene) {
   LOG("[LOADER] Texture created %d\n", texture);
   return cache.textureCache[path] = texture;
 }
+// Calls visit with the slot, 0 diffuse or 1 specular, and path of every
+// texture the material uses. Shared by the prefetch pass and processMaterial.
+template <typename F>
+static void materialTextures(const aiMaterial* mat, F visit) {
+  static const aiTextureType types[] = {aiTextureType_DIFFUSE, aiTextureType_SPECULAR};
+  for (int slot = 0; slot < 2; slot++) {
+    for (unsigned int i = 0; i < mat->GetTextureCount(types[slot]); i++) {
+      aiString path;
+      if (mat->GetTexture(types[slot], i, &path) == AI_SUCCESS) visit(slot, path.C_Str());
+    }
+  }
+}
+
 ENGINE_API int processMaterial(int materialIdx, const aiScene* scene, Scene* tracerScene) {
   auto it = cache.materialCache.find(materialIdx);
   if (it != cache.materialCache.end()) return it->second;
@@ -41,18 +140,12 @@ ENGINE_API int processMaterial(int materialIdx, const aiScene* scene, Scene* tra
   mat->Get(AI_MATKEY_COLOR_AMBIENT, traceMaterialPtr->ka);
   mat->Get(AI_MATKEY_COLOR_SPECULAR, traceMaterialPtr->ks);
 
-  static aiTextureType types[] = {aiTextureType_DIFFUSE, aiTextureType_SPECULAR};
-  //TODO: Magic number
-  for (int type = 0; type < 2; type++) {
-    for (int i = 0; i < mat->GetTextureCount(types[type]); i++) {
-      aiString path;
-      mat->GetTexture(types[type], i, &path);
-      switch (type) {
-        case 0: traceMaterialPtr->albedoTexture = processTexture(path.C_Str(), tracerScene); break;
-        case 1: traceMaterialPtr->specularTexture = processTexture(path.C_Str(), tracerScene); break;
-      }
+  materialTextures(mat, [&](int slot, const char* path) {
+    switch (slot) {
+      case 0: traceMaterialPtr->albedoTexture = processTexture(path, tracerScene); break;
+      case 1: traceMaterialPtr->specularTexture = processTexture(path, tracerScene); break;
     }
-  }
+  });
 
   LOG("[LOADER] Material created %d\n", (int)traceMaterialPtr);
   return cache.materialCache[materialIdx] = (int)traceMaterialPtr;
@@ -161,13 +254,23 @@ ENGINE_API void processNode(aiNode* node, const aiScene* scene, Scene* tracerSce
 }
 
 ENGINE_API int _sceneLoadOBJ(const char* path, Scene* scene) {
+  // Read while the importer sets up its loaders
+  filePrefetch(path);
   cache.clear();
   Assimp::Importer importer;
+  importer.SetIOHandler(new FileViewSystem());
   const aiScene*   scn = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
   if (!scn || scn->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scn->mRootNode) {
     LOG("[LOADER] Error processing mesh\n");
     return 1;
   }
+  // Textures are decoded one at a time during the node walk, reading all of
+  // them ahead keeps the disk busy while the first ones decode. OBJ textures
+  // are already on their way from prefetchReferences, other formats start here
+  for (unsigned int m = 0; m < scn->mNumMaterials; m++) {
+    materialTextures(scn->mMaterials[m], [](int, const char* path) { filePrefetch(path); });
+  }
+
   aiMatrix4x4 id;
   id.a1 = 1;
   id.b2 = 1;
@@ -1,202 +1,275 @@
 #include "imgui.h"
 #include <video.hpp>
 #include <implot/implot.h>
+#include "fdm/fdm.hpp"
+#include "fdmGpu.hpp"
+#include <cstring>
+#include <unordered_map>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb/stb_image_write.h>
 using namespace NextVideo;
 
-#define C                  299792458.0
-#define LIGHT_DECAY_FACTOR 1.0e-5
-#define INTEGRATION_ENABLED
-int INTEGRATION_STEPS = 4;
-#define GAMMA_CORRECTED   1.0
-#define A_WAVE            5000e-10
-#define A_SEPARATION      0.01e-3
-#define A_L               = 200.0e-3
-#define ZOOM              1e-4
-#define TIME_ZOOM         (1e-6 / C)
-
-int NCOUNT = 5;
-#define N NCOUNT
+int   INTEGRATION_STEPS    = 4;
+int   NCOUNT               = 5;
 bool  LIGHT_DECAY_ENABLED  = false;
 float LIGHT_DECAY_EXPONENT = 0.00002;
 float plotting_distance    = 200e-3;
-float plotting_resolution = 10;
-int plotting_count = 4000;
-int plot_highpassWindow = 10;
+float plotting_resolution  = 10;
+int   plotting_count       = 4000;
+int   plotting_precision   = FDM_PRECISION_FLOAT_REDUCED;
+bool  plotting_kahan       = false;
+bool  plotting_fourier     = false;
+bool  plotting_adaptive    = false;
+bool  plotting_gpu         = false;
+int   plotting_adaptiveMax = 1 << 16;
+int   plotting_fourierMode = FDM_FOURIER_AUTO;
+float plotting_slitWidth   = 0.0;
+int   plot_highpassWindow  = 10;
 
-#define B_SEPARATION 0.01e-3
-#define C_SEPARATION 0.001e-3
 /* CPU BACKEND */
-using namespace glm;
-
 float uLambda     = 5000e-10;
-float uAmpladaMul = C_SEPARATION;
-
-#define LAMBDA uLambda
-
+float uAmpladaMul = FDM_C_SEPARATION;
 
 bool uAmpladaFixa;
 bool uNormalitzarXarxa;
 
-float lightValue(vec2 st) {
-  return pow(0.1, LIGHT_DECAY_EXPONENT) / sqrt(st.x * st.x + st.y * st.y);
-}
+// Plot points selected by an index list, read straight from the plot buffers
+struct PlotIndexed {
+  const FdmPlot*          plot;
+  const std::vector<int>* indices;
+};
 
-float light(vec2 st, float t) {
-  float l = length(vec3(st.x, st.y, 0));
-  float k = 2.0 * M_PI / LAMBDA;
-  float f = C / LAMBDA;
-  float w = f * 2.0 * M_PI;
+ImPlotPoint plotIndexedGetter(int idx, void* data) {
+  auto* p = (PlotIndexed*)data;
+  int   i = (*p->indices)[idx];
+  return ImPlotPoint(p->plot->x[i], p->plot->y[i]);
+}
 
-  float value = (sin(l * k - t * w) * 0.5 + 0.5);
-  if (LIGHT_DECAY_ENABLED) return value * lightValue(st);
-  return value;
+/* GL CODE */
+/* GL CALLBACKS*/
+void messageCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam) {
+  fprintf(stdout, "GL CALLBACK: %s type = 0x%x, severity = 0x%x, message = %s\n", (type == GL_DEBUG_TYPE_ERROR ? "** GL ERROR **" : ""), type, severity, message);
 }
 
+// Program and uniform locations, one per specialized variant of fdm.glsl
+struct FdmProgram {
+  GLuint program;
+  GLuint iLambda;
+  GLuint iTime;
+  GLuint iZoom;
+  GLuint iResolution;
+  GLuint iIntegrationMode;
+  GLuint iDecayMode;
+  GLuint iDecayExponent;
+  GLuint iExperimentSelector;
+  GLuint iDistance;
+  GLuint iN;
+  GLuint iAmpladaFixa;
+  GLuint iNormalitzarXarxa;
+  GLuint iAmpladaMul;
+  GLuint iAccumulation;
+  GLuint iSampleTime;
+};
 
-float net(vec2 st, float off, float t, float separation) {
-  float result = 0.0;
-  if (uAmpladaFixa)
-    separation =  separation / float(N);
-  float offset = -float(N) * separation * 0.5 + off;
-  for (int i = 0; i < N; i++) {
-    result += light(st + vec2(0, offset), t);
-    offset += separation;
-  }
-  if (uNormalitzarXarxa)
-    return result / float(N);
-  return result;
-}
+// Variants are keyed by the switches baked into them. N is only baked, and
+// the net loop unrolled, up to this bound, larger N share a variant.
+#define FDM_VARIANT_MAX_N 16
+
+FdmProgram                               genericProgram;
+std::unordered_map<uint32_t, FdmProgram> programVariants;
+bool                                     useVariants = true;
+
+// Temporal accumulation, integration mode adds one time sample per frame to
+// a float sum in ping pong targets and shows the running mean. Any change of
+// the uniforms or of the surface size restarts it.
+#define FDM_ACCUMULATE_KEY (1u << 31)
+
+struct FdmAccumulation {
+  GLuint resolveProgram;
+  GLuint iAccumulation;
+  GLuint iSampleCount;
+  GLuint textures[2];
+  GLuint fbos[2];
+  int    current = 0;
+  int    samples = 0;
+  int    width   = 0;
+  int    height  = 0;
+  float  state[16];
+};
 
-float experimentA(vec2 st, float t) {
-  return light(st + vec2(0.0, -A_SEPARATION * 0.5), t) * 0.5 + light(st + vec2(0.0, A_SEPARATION * 0.5), t) * 0.5;
-}
-float experimentB(vec2 st, float t) {
-  return net(st, 0.0, t, B_SEPARATION);
-}
+FdmAccumulation accumulation;
+bool            useAccumulation   = false;
+int             accumulationLimit = 4096;
+FdmGpuProfile gpuProfile;
 
-typedef float (*experiment_t)(vec2 st, float t);
+#define INITIAL_LAMBDA 5000e-10
+#define MIN_LAMBDA     3000
+#define MAX_LAMBDA     8000
+// Uniforms
+float uDistance   = 0.0;
+float uZoom       = 1.0;
+float uTime       = 0.0;
+int   uExperiment = 0;
+bool  uIntegration;
 
-#define C_SEPARATION 0.001e-3
+bool experimentPractica = true;
 
-float experimentC(vec2 st, float t) {
-  return net(st, 0.0, t, uAmpladaMul);
+FdmParams currentParams() {
+  FdmParams params;
+  params.lambda           = uLambda;
+  params.ampladaMul       = uAmpladaMul;
+  params.decayExponent    = LIGHT_DECAY_EXPONENT;
+  params.n                = NCOUNT;
+  params.experiment       = uExperiment;
+  params.integrationSteps = INTEGRATION_STEPS;
+  params.ampladaFixa      = uAmpladaFixa;
+  params.normalitzarXarxa = uNormalitzarXarxa;
+  params.decayEnabled     = LIGHT_DECAY_ENABLED;
+  return params;
 }
 
-float experimentD(vec2 st, float t) {
-  float o = 0.1e-3;
-  return net(st, -o / 2.0, t, C_SEPARATION) * 0.5 + net(st, o / 2.0, t, C_SEPARATION) * 0.5;
+FdmPlotDesc currentPlotDesc() {
+  FdmPlotDesc desc;
+  desc.distance   = plotting_distance;
+  desc.resolution = plotting_resolution;
+  desc.count      = plotting_count;
+  desc.precision  = FdmPrecision(plotting_precision);
+  desc.kahan      = plotting_kahan;
+  return desc;
 }
 
-float integrate(vec2 st, float tP, experiment_t func) {
-
-  float result = 0.0;
-  float f      = C / A_WAVE;
-  float w      = f * 2.0 * M_PI;
-  float L      = float(INTEGRATION_STEPS);
-  float dt     = 2.0 * M_PI / (L * w);
-  float t      = 0.0;
-  for (int i = 0; i < INTEGRATION_STEPS; i++) {
-    float partial = func(st, t + tP);
-    result += partial * partial;
-    t += dt;
-  }
-  return result / L;
+void fdmProgramLocations(FdmProgram* p) {
+  if (p->program == 0) return;
+  p->iTime               = glGetUniformLocation(p->program, "iTime");
+  p->iZoom               = glGetUniformLocation(p->program, "iZoom");
+  p->iResolution         = glGetUniformLocation(p->program, "iResolution");
+  p->iIntegrationMode    = glGetUniformLocation(p->program, "iIntegrationMode");
+  p->iDecayMode          = glGetUniformLocation(p->program, "iDecayMode");
+  p->iDecayExponent      = glGetUniformLocation(p->program, "iDecayExponent");
+  p->iExperimentSelector = glGetUniformLocation(p->program, "iExperimentSelector");
+  p->iN                  = glGetUniformLocation(p->program, "N");
+  p->iDistance           = glGetUniformLocation(p->program, "iDistance");
+  p->iAmpladaFixa        = glGetUniformLocation(p->program, "iAmpladaFixa");
+  p->iNormalitzarXarxa   = glGetUniformLocation(p->program, "iNormalitzarXarxa");
+  p->iLambda             = glGetUniformLocation(p->program, "iLambda");
+  p->iAmpladaMul         = glGetUniformLocation(p->program, "iAmpladaMul");
+  p->iAccumulation       = glGetUniformLocation(p->program, "iAccumulation");
+  p->iSampleTime         = glGetUniformLocation(p->program, "iSampleTime");
 }
 
-struct PlotResult {
-  std::vector<float> y;
-  std::vector<float> x;
-};
-PlotResult plot(experiment_t func) {
-  float x     = plotting_distance;
-  float dy    = pow(10.0,-plotting_resolution);
-  int   count = plotting_count;
-
-  float      current = -dy * count / 2;
-  PlotResult res;
-  for (int i = 0; i < count; i++) {
-    res.y.push_back(integrate(glm::vec2(x, current), 0.0, func));
-    res.x.push_back(current);
-    current += dy;
-  }
-  return res;
+FdmProgram fdmProgramLoad(const char* defines) {
+  FdmProgram p;
+  p.program = glUtilLoadProgram("assets/filter.vs", "assets/fdm.glsl", defines);
+  fdmProgramLocations(&p);
+  return p;
 }
 
+// Programs are rebuilt in place while assets/fdm.glsl is edited, p has to stay
+// at the same address for as long as it is used
+void fdmProgramWatch(FdmProgram* p, const char* defines) {
+  GLUtilProgramLoad load;
+  load.vs      = "assets/filter.vs";
+  load.fs      = "assets/fdm.glsl";
+  load.defines = defines;
+  glUtilWatchProgram(&p->program, load, [p]() { fdmProgramLocations(p); });
+}
 
-std::vector<int> findLocalMaximumValues(std::vector<float>& data) {
-  int              lookUpSize = plot_highpassWindow;
-  std::vector<int> indices;
-  if (data.size() < (lookUpSize * 2 + 1)) return {};
+// Failed variants fall back to the generic program, which has no
+// accumulation entry point
+FdmProgram* programFallback(FdmProgram* variant, bool accumulate) {
+  if (variant->program) return variant;
+  return accumulate ? nullptr : &genericProgram;
+}
 
-  for (int i = lookUpSize; i < data.size() - lookUpSize - 1; i++) {
-    bool isMaxima = true;
-    for (int j = i - lookUpSize; j < i + lookUpSize; j++) {
-      if (data[j] > data[i]) {
-        isMaxima = false;
-        break;
-      }
-    }
-    if (isMaxima) indices.push_back(i);
+// Compiles the variant for the current switches the first time it is needed.
+// The accumulation entry point is a define too, so it always has a variant,
+// null is returned when that variant failed to compile.
+FdmProgram* programVariant(bool accumulate) {
+  if (!useVariants && !accumulate) return &genericProgram;
+
+  int      experiment = std::min(std::max(uExperiment, 0), 3);
+  int      n          = NCOUNT <= FDM_VARIANT_MAX_N ? NCOUNT : 0;
+  uint32_t key        = experiment | uIntegration << 2 | LIGHT_DECAY_ENABLED << 3 | uAmpladaFixa << 4 | uNormalitzarXarxa << 5 | n << 6;
+  if (!useVariants) key = 0;
+  if (accumulate) key |= FDM_ACCUMULATE_KEY;
+
+  // Failed variants stay in the map with program 0 so they are not retried
+  // every frame, a reload of a fixed source brings them back
+  auto it = programVariants.find(key);
+  if (it != programVariants.end()) return programFallback(&it->second, accumulate);
+
+  char defines[512];
+  int  length = 0;
+  if (useVariants) {
+    length = snprintf(defines, sizeof(defines),
+                      "#define EXPERIMENT %d\n#define INTEGRATION_MODE %s\n#define DECAY_MODE %s\n"
+                      "#define AMPLADA_FIXA %s\n#define NORMALITZAR_XARXA %s\n",
+                      experiment, uIntegration ? "true" : "false", LIGHT_DECAY_ENABLED ? "true" : "false",
+                      uAmpladaFixa ? "true" : "false", uNormalitzarXarxa ? "true" : "false");
+    if (n > 0) length += snprintf(defines + length, sizeof(defines) - length, "#define NET_N %d\n", n);
   }
-
-  return indices;
+  if (accumulate) snprintf(defines + length, sizeof(defines) - length, "#define ACCUMULATE\n");
+  else defines[length] = 0;
+
+  FdmProgram& variant = programVariants[key] = fdmProgramLoad(defines);
+  if (variant.program == GLuint(-1)) variant.program = 0;
+  if (variant.program == 0)
+    LOG("[FDM] Variant %x failed, %s\n", key, accumulate ? "drawing without accumulation" : "using the generic program");
+  fdmProgramWatch(&variant, defines);
+  return programFallback(&variant, accumulate);
 }
 
-/* GL CODE */
-/* GL CALLBACKS*/
-void messageCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam) {
-  fprintf(stdout, "GL CALLBACK: %s type = 0x%x, severity = 0x%x, message = %s\n", (type == GL_DEBUG_TYPE_ERROR ? "** GL ERROR **" : ""), type, severity, message);
+void accumulationInit(FdmAccumulation* a) {
+  GLUtilProgramLoad load;
+  load.vs           = "assets/filter.vs";
+  load.fs           = "assets/fdmResolve.glsl";
+  a->resolveProgram = glUtilLoadProgram(load.vs, load.fs);
+  auto locations    = [a]() {
+    a->iAccumulation = glGetUniformLocation(a->resolveProgram, "iAccumulation");
+    a->iSampleCount  = glGetUniformLocation(a->resolveProgram, "iSampleCount");
+  };
+  locations();
+  glUtilWatchProgram(&a->resolveProgram, load, locations);
+  glGenTextures(2, a->textures);
+  glGenFramebuffers(2, a->fbos);
 }
 
-GLuint iLambda;
-GLuint program;
-GLuint iTime;
-GLuint iZoom;
-GLuint iResolution;
-GLuint iIntegrationMode;
-GLuint iDecayMode;
-GLuint iDecayExponent;
-GLuint iExperimentSelector;
-GLuint iDistance;
-GLuint iN;
-GLuint iAmpladaFixa;
-GLuint iNormalitzarXarxa;
-GLuint iAmpladaMul;
-
-#define INITIAL_LAMBDA 5000e-10
-#define MIN_LAMBDA     3000
-#define MAX_LAMBDA     8000
-// Uniforms
-float uDistance   = 0.0;
-float uZoom       = 1.0;
-float uTime       = 0.0;
-int   uExperiment = 0;
-bool  uIntegration;
+// Restarts the sum when anything that changes the image differs from the
+// values the current sum was taken with
+void accumulationReset(FdmAccumulation* a, int width, int height, uint32_t program) {
+  float state[16] = {uTime, uZoom, uDistance, uLambda, uAmpladaMul, LIGHT_DECAY_EXPONENT, float(uExperiment), float(NCOUNT),
+                     float(LIGHT_DECAY_ENABLED), float(uAmpladaFixa), float(uNormalitzarXarxa), float(program)};
+
+  if (width != a->width || height != a->height) {
+    for (int i = 0; i < 2; i++) {
+      glBindTexture(GL_TEXTURE_2D, a->textures[i]);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT, NULL);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+      glBindFramebuffer(GL_FRAMEBUFFER, a->fbos[i]);
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, a->textures[i], 0);
+      VERIFY(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE, "Accumulation target incomplete\n");
+    }
+    a->width   = width;
+    a->height  = height;
+    a->samples = 0;
+  }
 
-bool experimentPractica = true;
+  if (a->samples > 0 && memcmp(state, a->state, sizeof(state)) == 0) return;
+  memcpy(a->state, state, sizeof(state));
 
-experiment_t currentExperiment() {
-  if (uExperiment == 0) return experimentA;
-  if (uExperiment == 1) return experimentB;
-  if (uExperiment == 2) return experimentC;
-  if (uExperiment >= 3) return experimentD;
+  const float zero[4] = {0, 0, 0, 0};
+  glBindFramebuffer(GL_FRAMEBUFFER, a->fbos[a->current]);
+  glClearBufferfv(GL_COLOR, 0, zero);
+  a->samples = 0;
 }
 
 void init() {
-  program             = glUtilLoadProgram("assets/filter.vs", "assets/fdm.glsl");
-  iTime               = glGetUniformLocation(program, "iTime");
-  iZoom               = glGetUniformLocation(program, "iZoom");
-  iResolution         = glGetUniformLocation(program, "iResolution");
-  iIntegrationMode    = glGetUniformLocation(program, "iIntegrationMode");
-  iDecayMode          = glGetUniformLocation(program, "iDecayMode");
-  iDecayExponent      = glGetUniformLocation(program, "iDecayExponent");
-  iExperimentSelector = glGetUniformLocation(program, "iExperimentSelector");
-  iN                  = glGetUniformLocation(program, "N");
-  iDistance           = glGetUniformLocation(program, "iDistance");
-  iAmpladaFixa        = glGetUniformLocation(program, "iAmpladaFixa");
-  iNormalitzarXarxa   = glGetUniformLocation(program, "iNormalitzarXarxa");
-  iLambda             = glGetUniformLocation(program, "iLambda");
-  iAmpladaMul         = glGetUniformLocation(program, "iAmpladaMul");
+  genericProgram = fdmProgramLoad(nullptr);
+  fdmProgramWatch(&genericProgram, nullptr);
+  accumulationInit(&accumulation);
+  fdmGpuProfileInit(&gpuProfile);
 }
 
 NextVideo::ISurface* surface;
@@ -211,6 +284,9 @@ void uiRender() {
     ImGui::Text("Simulation parameters");
     ImGui::Checkbox("Use light decay", &LIGHT_DECAY_ENABLED);
     ImGui::Checkbox("Integration", &uIntegration);
+    ImGui::Checkbox("Temporal accumulation", &useAccumulation);
+    ImGui::InputInt("Accumulation samples", &accumulationLimit);
+    if (useAccumulation && uIntegration) ImGui::Text("Accumulated %d samples\n", accumulation.samples);
     ImGui::Checkbox("Amplada fixa", &uAmpladaFixa);
     ImGui::Checkbox("Normalitzar xarxa", &uNormalitzarXarxa);
     ImGui::SliderFloat("Light decay exponent", &LIGHT_DECAY_EXPONENT, 1.0, 10.0);
@@ -222,18 +298,29 @@ void uiRender() {
     ImGui::SliderInt("Light lambda", &lambdaSlider, 2000, 8000);
     ImGui::SliderInt("N", &NCOUNT, 2, 50);
     ImGui::InputFloat("Distance", &uDistance);
+    ImGui::Checkbox("Specialized shaders", &useVariants);
+    ImGui::Text("Compiled variants: %lu\n", programVariants.size());
 
     ImGui::Separator();
     ImGui::InputFloat("Plot resolution", &plotting_resolution);
     ImGui::InputInt("Plot count", &plotting_count);
     ImGui::InputInt("Plot high pass winow", &plot_highpassWindow);
+    ImGui::Combo("Plot precision", &plotting_precision, FDM_PRECISION_NAMES, FDM_PRECISION_LAST);
+    ImGui::Checkbox("Plot kahan summation", &plotting_kahan);
+    ImGui::Checkbox("Plot with fourier solver", &plotting_fourier);
+    ImGui::Checkbox("Plot adaptive sampling", &plotting_adaptive);
+    ImGui::Checkbox("Plot on GPU", &plotting_gpu);
+    ImGui::InputInt("Adaptive sample budget", &plotting_adaptiveMax);
+    plotting_adaptiveMax = std::max(plotting_adaptiveMax, FdmAdaptiveDesc().initialCount);
+    ImGui::Combo("Fourier propagator", &plotting_fourierMode, FDM_FOURIER_NAMES, FDM_FOURIER_LAST);
+    ImGui::InputFloat("Fourier slit width", &plotting_slitWidth, 0.0f, 0.0f, "%e");
 
     ImGui::Separator();
     ImGui::InputInt("Integration steps ", &INTEGRATION_STEPS);
     ImGui::End();
 
     uLambda = float(lambdaSlider) * 1e-10;
-    uAmpladaMul = AmpladaSlider * C_SEPARATION;
+    uAmpladaMul = AmpladaSlider * FDM_C_SEPARATION;
   }
 
 
@@ -248,35 +335,54 @@ void uiRender() {
     if (showPlot) {
       ImGui::SliderFloat("Screen distance", &plotting_distance, 0.0, 1.0);
       static bool currentPlot = 0;
-      auto        data        = plot(currentExperiment());
-
-      auto maximum = findLocalMaximumValues(data.y);
-
-      std::vector<float> xMaxData;
-      std::vector<float> yMaxData;
-
-      if (maximum.size() > 0) {
-        for (int i = 0; i < maximum.size(); i++) {
-          xMaxData.push_back(data.x[maximum[i]]);
-          yMaxData.push_back(data.y[maximum[i]]);
-        }
+      FdmPlot     data;
+
+      // GPU results arrive a few frames late and are kept until replaced
+      static FdmGpuResult gpuResult;
+      if (plotting_gpu) {
+        fdmGpuProfileDispatch(&gpuProfile, currentParams(), currentPlotDesc(), plot_highpassWindow);
+        fdmGpuProfileRead(&gpuProfile, &gpuResult);
+        data = gpuResult.max;
+        ImGui::Text("GPU profile: %d samples in %lu buckets, %d local maxima\n", gpuResult.count, data.x.size(), gpuResult.peakCount);
+      } else if (plotting_fourier) {
+        static FdmFourier fourier;
+        FdmFourierDesc    fourierDesc;
+        fourierDesc.mode      = FdmFourierMode(plotting_fourierMode);
+        fourierDesc.slitWidth = plotting_slitWidth;
+        fdmFourierPlot(&fourier, currentParams(), currentPlotDesc(), fourierDesc, &data);
+        ImGui::Text("Fourier solver: %s, %d bins\n", FDM_FOURIER_NAMES[fourier.lastMode], (int)fourier.field.size());
+      } else if (plotting_adaptive) {
+        // Refined a batch per frame, restarted whenever a parameter changes
+        static FdmAdaptive adaptive;
+        FdmAdaptiveDesc    adaptiveDesc;
+        adaptiveDesc.maxCount = plotting_adaptiveMax;
+        if (!fdmAdaptiveMatches(&adaptive, currentParams(), currentPlotDesc()))
+          fdmAdaptiveReset(&adaptive, currentParams(), currentPlotDesc(), adaptiveDesc);
+        bool refining = fdmAdaptiveRefine(&adaptive, adaptiveDesc, &data);
+        ImGui::Text("Adaptive: %lu of %d samples%s\n", data.x.size(), plotting_count, refining ? ", refining" : "");
+      } else {
+        fdmPlot(currentParams(), currentPlotDesc(), &data);
       }
-      std::vector<int> maximum2;
-      if (maximum.size() > 0) maximum2 = findLocalMaximumValues(yMaxData);
 
+      static FdmPeaks peaks;
+      if (plotting_gpu) {
+        // Peaks and range are reduced on the GPU over every sample, the
+        // envelope is taken over the buckets holding those peaks
+        peaks.peaks    = gpuResult.peaks;
+        peaks.minValue = gpuResult.minValue;
+        peaks.maxValue = gpuResult.maxValue;
+        fdmPeakEnvelope(data.x.data(), data.y.data(), plot_highpassWindow, &peaks);
+      } else {
+        fdmFindPeaks(data.x.data(), data.y.data(), data.y.size(), plot_highpassWindow, &peaks);
+      }
 
       static bool normalizeData = false;
 
       ImGui::Checkbox("Normalize data", &normalizeData);
 
       if (normalizeData) {
-        float minVal = 10e50;
-        float maxVal = -10e50;
-
-        for (int i = 0; i < data.y.size(); i++) {
-          maxVal = std::max(data.y[i], maxVal);
-          minVal = std::min(data.y[i], minVal);
-        }
+        float minVal = peaks.minValue;
+        float maxVal = peaks.maxValue;
 
         ImGui::Text("Min value %f\n", minVal);
         ImGui::Text("Max value %f\n", maxVal);
@@ -287,23 +393,18 @@ void uiRender() {
         }
       }
 
+      PlotIndexed maxima   = {&data, &peaks.peaks};
+      PlotIndexed envelope = {&data, &peaks.envelope};
+
       if (ImPlot::BeginPlot("FDM", "Distancia en X", "Intensitat llum", ImVec2(800, 400))) {
         ImPlot::PlotLine("Integration", data.x.data(), data.y.data(), data.x.size());
 
-        if (maximum.size() > 0) {
-          ImPlot::PlotScatter("Local maxima", xMaxData.data(), yMaxData.data(), xMaxData.size());
-
-          if (maximum2.size() > 0) {
-            ImPlot::PlotLine("Local maxima function", xMaxData.data(), yMaxData.data(), xMaxData.size());
+        if (peaks.peaks.size() > 0) {
+          ImPlot::PlotScatterG("Local maxima", plotIndexedGetter, &maxima, peaks.peaks.size());
 
-            std::vector<float> xMax;
-            std::vector<float> yMax;
-            for (int i = 0; i < maximum2.size(); i++) {
-              xMax.push_back(xMaxData[maximum2[i]]);
-              yMax.push_back(yMaxData[maximum2[i]]);
-            }
-
-            ImPlot::PlotScatter("Local maxima max", xMax.data(), yMax.data(), xMax.size());
+          if (peaks.envelope.size() > 0) {
+            ImPlot::PlotLineG("Local maxima function", plotIndexedGetter, &maxima, peaks.peaks.size());
+            ImPlot::PlotScatterG("Local maxima max", plotIndexedGetter, &envelope, peaks.envelope.size());
           }
         }
 
@@ -311,42 +412,143 @@ void uiRender() {
       }
 
       ImGui::Separator();
-      if (maximum2.size() > 0) {
-        ImGui::Text("Find max maximum %lu\n", maximum2.size());
-        for (int i = 0; i < maximum2.size(); i++) {
-          ImGui::Text("Local at: %d (%f - %f)\n", maximum2[i], xMaxData[maximum2[i]], yMaxData[maximum2[i]]);
+      if (peaks.envelope.size() > 0) {
+        ImGui::Text("Find max maximum %lu\n", peaks.envelope.size());
+        for (int i = 0; i < peaks.envelope.size(); i++) {
+          int index = peaks.envelope[i];
+          ImGui::Text("Local at: %d (%f - %f)\n", index, data.x[index], data.y[index]);
         }
 
-        for (int i = 1; i < maximum2.size(); i++) {
-          ImGui::Text("Difference between maximums: %f\n", xMaxData[maximum2[i]] - xMaxData[maximum2[i]]);
+        for (int i = 1; i < peaks.envelope.size(); i++) {
+          ImGui::Text("Difference between maximums: %f\n", data.x[peaks.envelope[i]] - data.x[peaks.envelope[i - 1]]);
         }
+        ImGui::Text("Mean fringe spacing: %e\n", peaks.spacing);
       } else {
         ImGui::Text("No max maximum found!\n");
       }
     }
   }
 }
+void renderUniforms(FdmProgram* p, int width, int height) {
+  glUniform1f(p->iTime, uTime);
+  glUniform1f(p->iZoom, uZoom);
+  glUniform2f(p->iResolution, width, height);
+  glUniform1i(p->iIntegrationMode, uIntegration);
+  glUniform1i(p->iDecayMode, LIGHT_DECAY_ENABLED);
+  glUniform1f(p->iDecayExponent, LIGHT_DECAY_EXPONENT);
+  glUniform1i(p->iExperimentSelector, uExperiment);
+  glUniform1f(p->iDistance, uDistance);
+  glUniform1i(p->iN, NCOUNT);
+  glUniform1i(p->iAmpladaFixa, uAmpladaFixa);
+  glUniform1i(p->iNormalitzarXarxa, uNormalitzarXarxa);
+  glUniform1f(p->iAmpladaMul, uAmpladaMul);
+  glUniform1f(p->iLambda, uLambda);
+}
+
+void renderAccumulated(FdmProgram* p, int width, int height) {
+  FdmAccumulation* a = &accumulation;
+  accumulationReset(a, width, height, p->program);
+  glViewport(0, 0, width, height);
+
+  if (a->samples < accumulationLimit) {
+    // Golden ratio sequence over one period of the reference wave, the time
+    // samples stay evenly spread whenever the accumulation is looked at
+    double period = FDM_A_WAVE / FDM_C;
+    double phase  = std::fmod(0.5 + a->samples * 0.6180339887498949, 1.0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, a->fbos[1 - a->current]);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, a->textures[a->current]);
+    glUseProgram(p->program);
+    renderUniforms(p, width, height);
+    glUniform1i(p->iAccumulation, 0);
+    glUniform1f(p->iSampleTime, float(phase * period));
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    a->current = 1 - a->current;
+    a->samples++;
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, a->textures[a->current]);
+  glUseProgram(a->resolveProgram);
+  glUniform1i(a->iAccumulation, 0);
+  glUniform1f(a->iSampleCount, float(std::max(a->samples, 1)));
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+}
+
 void render() {
-  glViewport(0, 0, surface->getWidth(), surface->getHeight());
-  glUseProgram(program);
-  glUniform1f(iTime, uTime);
-  glUniform1f(iZoom, uZoom);
-  glUniform2f(iResolution, surface->getWidth(), surface->getHeight());
-  glUniform1i(iIntegrationMode, uIntegration);
-  glUniform1i(iDecayMode, LIGHT_DECAY_ENABLED);
-  glUniform1f(iDecayExponent, LIGHT_DECAY_EXPONENT);
-  glUniform1i(iExperimentSelector, uExperiment);
-  glUniform1f(iDistance, uDistance);
-  glUniform1i(iN, NCOUNT);
-  glUniform1i(iAmpladaFixa, uAmpladaFixa);
-  glUniform1i(iNormalitzarXarxa, uNormalitzarXarxa);
-  glUniform1f(iAmpladaMul, uAmpladaMul);
-  glUniform1f(iLambda, uLambda);
+  bool        accumulate = useAccumulation && uIntegration;
+  FdmProgram* p          = programVariant(accumulate);
+  const int   width      = surface->getWidth();
+  const int   height     = surface->getHeight();
+
+  // The accumulation variant did not compile, the frame is drawn directly
+  if (p == nullptr) {
+    accumulate = false;
+    p          = programVariant(false);
+  }
+
+  if (accumulate) {
+    renderAccumulated(p, width, height);
+    return;
+  }
+
+  glViewport(0, 0, width, height);
+  glUseProgram(p->program);
+  renderUniforms(p, width, height);
   glDrawArrays(GL_TRIANGLES, 0, 6);
 }
 
+/* HEADLESS IMAGE */
+// fdm --image <out.png> [options], renders the shader field on the CPU
+int imageMain(int argc, char** argv) {
+  if (argc < 1) {
+    fprintf(stderr, "usage: fdm --image <out.png> [--width w] [--height h] [--zoom z] [--time t] [--distance d]\n"
+                    "       [--experiment e] [--n n] [--lambda l] [--separation s] [--decay exponent]\n"
+                    "       [--integration] [--amplada-fixa] [--threads count]\n");
+    return 1;
+  }
+
+  FdmParams    params;
+  FdmImageDesc desc;
+  for (int i = 1; i < argc; i++) {
+    const char* arg   = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : "0";
+    if (strcmp(arg, "--integration") == 0) desc.integration = true;
+    else if (strcmp(arg, "--amplada-fixa") == 0) params.ampladaFixa = true;
+    else if (strcmp(arg, "--width") == 0 && ++i) desc.width = atoi(value);
+    else if (strcmp(arg, "--height") == 0 && ++i) desc.height = atoi(value);
+    else if (strcmp(arg, "--zoom") == 0 && ++i) desc.zoom = atof(value);
+    else if (strcmp(arg, "--time") == 0 && ++i) desc.time = atof(value);
+    else if (strcmp(arg, "--distance") == 0 && ++i) desc.distance = atof(value);
+    else if (strcmp(arg, "--experiment") == 0 && ++i) params.experiment = atoi(value);
+    else if (strcmp(arg, "--n") == 0 && ++i) params.n = atoi(value);
+    else if (strcmp(arg, "--lambda") == 0 && ++i) params.lambda = atof(value);
+    else if (strcmp(arg, "--separation") == 0 && ++i) params.ampladaMul = atof(value);
+    else if (strcmp(arg, "--decay") == 0 && ++i) params.decayEnabled = true, params.decayExponent = atof(value);
+    else if (strcmp(arg, "--threads") == 0 && ++i) desc.threads = atoi(value);
+    else {
+      fprintf(stderr, "[IMAGE] Invalid argument %s\n", arg);
+      return 1;
+    }
+  }
+
+  FdmImage image;
+  fdmImage(params, desc, &image);
+  if (!stbi_write_png(argv[0], image.width, image.height, 1, image.pixels.data(), image.width)) {
+    fprintf(stderr, "[IMAGE] Error writing %s\n", argv[0]);
+    return 1;
+  }
+  return 0;
+}
+
 /* MAIN CODE */
-int main() {
+int main(int argc, char** argv) {
+  // Headless parameter sweep, runs without creating a surface
+  if (argc > 1 && strcmp(argv[1], "--sweep") == 0) return fdmSweepMain(argc - 2, argv + 2);
+  if (argc > 1 && strcmp(argv[1], "--image") == 0) return imageMain(argc - 2, argv + 2);
+
   SurfaceDesc desc;
   desc.width  = 1920;
   desc.height = 1080;
@@ -360,6 +562,7 @@ int main() {
   init();
   ImPlot::CreateContext();
   do {
+    glUtilReloadPrograms();
     if (surface->getWidth() > 0 && surface->getHeight() > 0) {
       glBindVertexArray(vao);
       render();
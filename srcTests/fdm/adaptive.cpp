@@ -0,0 +1,135 @@
+#include "fdm.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Distance from the middle sample to the chord through its neighbours
+static float fdmAdaptiveDeviation(const FdmAdaptive* a, int i0, int i1, int i2) {
+  double t = (a->x[i1] - a->x[i0]) / (a->x[i2] - a->x[i0]);
+  return std::abs(a->y[i1] - float(a->y[i0] + (a->y[i2] - a->y[i0]) * t));
+}
+
+static float fdmAdaptiveError(const FdmAdaptive* a, int left, int right) {
+  const float range  = std::max(a->maxValue - a->minValue, 1e-30f);
+  int         before = a->prev[left];
+  int         after  = a->next[right];
+
+  // Intervals at the ends of the range have a single neighbour to compare with
+  float error = before < 0 && after < 0 ? std::abs(a->y[right] - a->y[left]) : 0.0f;
+  if (before >= 0) error = std::max(error, fdmAdaptiveDeviation(a, before, left, right));
+  if (after >= 0) error = std::max(error, fdmAdaptiveDeviation(a, left, right, after));
+  return error / range;
+}
+
+static void fdmAdaptivePush(FdmAdaptive* a, int left, int right, double minWidth) {
+  if (a->x[right] - a->x[left] < 2.0 * minWidth) return;
+  a->heap.push_back({fdmAdaptiveError(a, left, right), left, right});
+  std::push_heap(a->heap.begin(), a->heap.end());
+}
+
+static void fdmAdaptiveRange(FdmAdaptive* a, int first, int last) {
+  for (int i = first; i < last; i++) {
+    a->minValue = std::min(a->minValue, a->y[i]);
+    a->maxValue = std::max(a->maxValue, a->y[i]);
+  }
+}
+
+bool fdmAdaptiveMatches(const FdmAdaptive* a, const FdmParams& params, const FdmPlotDesc& desc) {
+  const FdmParams&   p = a->params;
+  const FdmPlotDesc& d = a->desc;
+  return !a->x.empty() && p.lambda == params.lambda && p.ampladaMul == params.ampladaMul && p.decayExponent == params.decayExponent &&
+         p.n == params.n && p.experiment == params.experiment && p.integrationSteps == params.integrationSteps &&
+         p.ampladaFixa == params.ampladaFixa && p.normalitzarXarxa == params.normalitzarXarxa && p.decayEnabled == params.decayEnabled &&
+         d.distance == desc.distance && d.resolution == desc.resolution && d.count == desc.count && d.precision == desc.precision &&
+         d.kahan == desc.kahan;
+}
+
+void fdmAdaptiveReset(FdmAdaptive* a, const FdmParams& params, const FdmPlotDesc& desc, const FdmAdaptiveDesc& adaptiveDesc) {
+  const double dy    = std::pow(10.0, -desc.resolution);
+  const int    count = std::max(std::min(adaptiveDesc.initialCount, desc.count), 2);
+  const double begin = -dy * desc.count / 2;
+  const double end   = begin + dy * (desc.count - 1);
+
+  a->params    = params;
+  a->desc      = desc;
+  a->converged = false;
+  a->x.resize(count);
+  a->y.resize(count);
+  a->next.resize(count);
+  a->prev.resize(count);
+  a->heap.clear();
+
+  // A single sample has no interval to refine, its deviation would be 0 / 0
+  if (desc.count <= 1) {
+    const int single = std::max(desc.count, 0);
+    a->x.assign(single, begin);
+    a->y.resize(single);
+    a->next.assign(single, -1);
+    a->prev.assign(single, -1);
+    fdmEvaluate(params, desc, a->x.data(), a->y.data(), single);
+    a->minValue  = single ? a->y[0] : 0.0f;
+    a->maxValue  = a->minValue;
+    a->converged = true;
+    return;
+  }
+
+  for (int i = 0; i < count; i++) {
+    a->x[i]    = begin + (end - begin) * i / double(count - 1);
+    a->next[i] = i + 1 < count ? i + 1 : -1;
+    a->prev[i] = i - 1;
+  }
+  fdmEvaluate(params, desc, a->x.data(), a->y.data(), count);
+
+  a->minValue = a->y[0];
+  a->maxValue = a->y[0];
+  fdmAdaptiveRange(a, 0, count);
+  for (int i = 0; i + 1 < count; i++) fdmAdaptivePush(a, i, i + 1, dy);
+}
+
+bool fdmAdaptiveRefine(FdmAdaptive* a, const FdmAdaptiveDesc& adaptiveDesc, FdmPlot* out) {
+  const double dy = std::pow(10.0, -a->desc.resolution);
+
+  if (!a->converged) {
+    // Pops the worst intervals, skipping the ones already split
+    std::vector<FdmAdaptiveInterval> split;
+    // The budget may have been lowered below the samples already taken
+    const int budget = std::max(std::min(adaptiveDesc.batch, adaptiveDesc.maxCount - int(a->x.size())), 0);
+    while (int(split.size()) < budget && !a->heap.empty()) {
+      std::pop_heap(a->heap.begin(), a->heap.end());
+      FdmAdaptiveInterval interval = a->heap.back();
+      a->heap.pop_back();
+      if (a->next[interval.left] != interval.right) continue;
+      if (interval.error < adaptiveDesc.tolerance) {
+        a->heap.clear();
+        break;
+      }
+      split.push_back(interval);
+    }
+
+    const int first = a->x.size();
+    for (const FdmAdaptiveInterval& interval : split) {
+      int m = a->x.size();
+      a->x.push_back((a->x[interval.left] + a->x[interval.right]) * 0.5);
+      a->next.push_back(interval.right);
+      a->prev.push_back(interval.left);
+      a->next[interval.left]  = m;
+      a->prev[interval.right] = m;
+    }
+    a->y.resize(a->x.size());
+    fdmEvaluate(a->params, a->desc, a->x.data() + first, a->y.data() + first, a->x.size() - first);
+    fdmAdaptiveRange(a, first, a->x.size());
+
+    for (int m = first; m < int(a->x.size()); m++) {
+      fdmAdaptivePush(a, a->prev[m], m, dy);
+      fdmAdaptivePush(a, m, a->next[m], dy);
+    }
+    a->converged = a->heap.empty() || int(a->x.size()) >= adaptiveDesc.maxCount;
+  }
+
+  out->x.resize(a->x.size());
+  out->y.resize(a->x.size());
+  for (int i = 0, s = a->x.empty() ? -1 : 0; s >= 0; i++, s = a->next[s]) {
+    out->x[i] = float(a->x[s]);
+    out->y[i] = a->y[s];
+  }
+  return !a->converged;
+}
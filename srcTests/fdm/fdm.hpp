@@ -0,0 +1,216 @@
+#pragma once
+#include <complex>
+#include <vector>
+
+/* FDM CPU CORE */
+// Physics shared by the interactive fdm viewer and the headless tools. The
+// experiments are the same ones implemented by assets/fdm.glsl, expressed as
+// a list of point sources on the aperture plane.
+
+#define FDM_C            299792458.0
+#define FDM_A_WAVE       5000e-10
+#define FDM_A_SEPARATION 0.01e-3
+#define FDM_B_SEPARATION 0.01e-3
+#define FDM_C_SEPARATION 0.001e-3
+#define FDM_D_OFFSET     0.1e-3
+
+struct FdmParams {
+  double lambda           = 5000e-10;
+  double ampladaMul       = FDM_C_SEPARATION;
+  double decayExponent    = 0.00002;
+  int    n                = 5;
+  int    experiment       = 0;
+  int    integrationSteps = 4;
+  bool   ampladaFixa      = false;
+  bool   normalitzarXarxa = false;
+  bool   decayEnabled     = false;
+};
+
+// Point sources implied by an experiment, offsets are along the screen axis
+struct FdmSources {
+  std::vector<double> offset;
+  std::vector<double> weight;
+};
+
+void fdmSources(const FdmParams& params, FdmSources* out);
+
+/* Sampling precision */
+enum FdmPrecision {
+  FDM_PRECISION_FLOAT,         // Original behaviour, phases l * k in float
+  FDM_PRECISION_DOUBLE,        // Everything in double
+  FDM_PRECISION_FLOAT_REDUCED, // Float, phase taken relative to the aperture centre
+  FDM_PRECISION_EXTENDED,      // long double, used as reference
+  FDM_PRECISION_LAST
+};
+
+static const char* const FDM_PRECISION_NAMES[] = {"Float", "Double", "Float (phase reduced)", "Extended"};
+
+struct FdmPlotDesc {
+  double       distance   = 200e-3;
+  double       resolution = 10;
+  int          count      = 4000;
+  FdmPrecision precision  = FDM_PRECISION_FLOAT_REDUCED;
+  bool         kahan      = false;
+};
+
+struct FdmPlot {
+  std::vector<float> y;
+  std::vector<float> x;
+};
+
+// Time integrated intensity at screen positions, distance is taken from desc
+void fdmEvaluate(const FdmParams& params, const FdmPlotDesc& desc, const double* positions, float* out, int count);
+void fdmPlot(const FdmParams& params, const FdmPlotDesc& desc, FdmPlot* out);
+
+/* Fourier solver */
+// Evaluates the same plot from the aperture function in O(M log M). The
+// result is the exact time average A^2 + |E|^2 / 8 of the superposition model,
+// where A is the constant bias of the sources and E their complex field.
+enum FdmFourierMode {
+  FDM_FOURIER_AUTO,              // Picks a propagator from the Fresnel number
+  FDM_FOURIER_FAR_FIELD,         // Fraunhofer, one FFT of the aperture
+  FDM_FOURIER_ANGULAR_SPECTRUM,  // Exact propagation for short distances
+  FDM_FOURIER_LAST
+};
+
+static const char* const FDM_FOURIER_NAMES[] = {"Auto", "Fraunhofer", "Angular spectrum"};
+
+struct FdmFourierDesc {
+  FdmFourierMode mode      = FDM_FOURIER_AUTO;
+  int            size      = 1 << 14; // Minimum transform size
+  int            maxSize   = 1 << 20;
+  double         slitWidth = 0.0;     // 0 means point sources
+};
+
+// Transform plan and scratch buffers, reused while the size does not change
+struct FdmFourier {
+  std::vector<std::complex<double>> twiddle;
+  std::vector<int>                  reverse;
+  std::vector<std::complex<double>> field;
+  FdmFourierMode                    lastMode = FDM_FOURIER_AUTO; // Propagator the last plot resolved to
+};
+
+void fdmFourierPlot(FdmFourier* fourier, const FdmParams& params, const FdmPlotDesc& desc, const FdmFourierDesc& fourierDesc, FdmPlot* out);
+
+/* Peak detection */
+// Local maxima are samples that are not exceeded inside +-window samples. The
+// envelope holds the maxima of the peaks themselves, as indices into the plot.
+struct FdmPeaks {
+  std::vector<int> peaks;
+  std::vector<int> envelope;
+  double           spacing  = 0.0; // Mean distance between envelope maxima, in x units
+  float            minValue = 0.0f;
+  float            maxValue = 0.0f;
+
+  std::vector<int>   deque;  // Scratch, kept to avoid reallocating every frame
+  std::vector<float> windowMax;
+};
+
+void fdmFindPeaks(const float* x, const float* y, int count, int window, FdmPeaks* out);
+// Rebuilds the envelope and spacing from out->peaks, for peaks found elsewhere
+void fdmPeakEnvelope(const float* x, const float* y, int window, FdmPeaks* out);
+
+/* Parameter sweep */
+// Axes are inclusive linear ranges, a count of 1 keeps the value in params
+struct FdmSweepAxis {
+  double begin = 0.0;
+  double end   = 0.0;
+  int    count = 1;
+
+  inline double value(int i) const { return count > 1 ? begin + (end - begin) * i / double(count - 1) : begin; }
+};
+
+enum FdmSweepFormat { FDM_SWEEP_CSV, FDM_SWEEP_BINARY };
+
+struct FdmSweepDesc {
+  FdmParams      params;
+  FdmPlotDesc    plot;
+  FdmSweepAxis   lambda;
+  FdmSweepAxis   n;
+  FdmSweepAxis   separation;
+  FdmSweepAxis   distance;
+  FdmSweepFormat format     = FDM_SWEEP_CSV;
+  const char*    output     = "sweep.csv";
+  bool           fourier    = false;
+  bool           summary    = false; // One row per point instead of the whole profile
+  int            peakWindow = 10;
+  int            threads    = 0;     // 0 uses every core
+};
+
+int fdmSweep(const FdmSweepDesc& desc);
+int fdmSweepMain(int argc, char** argv);
+
+/* Intensity map */
+// CPU port of assets/fdm.glsl, evaluated in float with the same expressions so
+// the result matches the shader output within sin rounding. FdmParams maps to
+// the shader uniforms; integrationSteps is ignored because the shader fixes it.
+#define FDM_SHADER_INTEGRATION_STEPS 4
+#define FDM_SHADER_ZOOM              1e-4f
+
+struct FdmImageDesc {
+  int   width       = 1920;
+  int   height      = 1080;
+  float zoom        = 1.0f;  // iZoom
+  float time        = 0.0f;  // iTime
+  float distance    = 0.0f;  // iDistance
+  bool  integration = false; // iIntegrationMode
+  int   tileWidth   = 64;
+  int   tileHeight  = 16;
+  int   threads     = 0;     // 0 uses every core
+};
+
+// Rows are stored top to bottom, value holds the unclamped shader result and
+// pixels the 8 bit value the default framebuffer would store
+struct FdmImage {
+  int                        width  = 0;
+  int                        height = 0;
+  std::vector<float>         value;
+  std::vector<unsigned char> pixels;
+};
+
+void fdmImage(const FdmParams& params, const FdmImageDesc& desc, FdmImage* out);
+
+/* Adaptive sampling */
+// Samples the same range as fdmPlot, starting from a coarse uniform pass and
+// splitting the intervals with the largest error first. The error of an
+// interval is how far its end samples deviate from the chords through their
+// neighbours, relative to the value range, so flat and linear regions stop
+// early and fringes keep being refined down to the spacing fdmPlot would use.
+struct FdmAdaptiveDesc {
+  int    initialCount = 256;
+  int    maxCount     = 1 << 16; // Sample budget
+  int    batch        = 1024;    // Evaluations per refine call
+  double tolerance    = 1e-3;    // Stop once every interval is below this
+};
+
+struct FdmAdaptiveInterval {
+  float error;
+  int   left;
+  int   right;
+
+  inline bool operator<(const FdmAdaptiveInterval& o) const { return error < o.error; }
+};
+
+struct FdmAdaptive {
+  FdmParams   params;
+  FdmPlotDesc desc;
+
+  // Samples in evaluation order, next links them in ascending x
+  std::vector<double> x;
+  std::vector<float>  y;
+  std::vector<int>    next;
+  std::vector<int>    prev;
+
+  std::vector<FdmAdaptiveInterval> heap;
+  float                            minValue  = 0.0f;
+  float                            maxValue  = 0.0f;
+  bool                             converged = false;
+};
+
+// True when the samples were taken with these parameters
+bool fdmAdaptiveMatches(const FdmAdaptive* adaptive, const FdmParams& params, const FdmPlotDesc& desc);
+void fdmAdaptiveReset(FdmAdaptive* adaptive, const FdmParams& params, const FdmPlotDesc& desc, const FdmAdaptiveDesc& adaptiveDesc);
+
+// Evaluates one batch and writes the samples so far, sorted, into out.
+// Returns false once the budget is spent or the tolerance is met.
+bool fdmAdaptiveRefine(FdmAdaptive* adaptive, const FdmAdaptiveDesc& adaptiveDesc, FdmPlot* out);
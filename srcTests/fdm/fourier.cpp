@@ -0,0 +1,229 @@
+#include "fdm.hpp"
+#include <algorithm>
+#include <cmath>
+
+typedef std::complex<double> complex;
+
+static int nextPowerOfTwo(double value) {
+  int size = 1;
+  while (size < value && size < (1 << 30)) size <<= 1;
+  return size;
+}
+
+static void fdmFftPlan(FdmFourier* fourier, int size) {
+  if (int(fourier->reverse.size()) == size) return;
+
+  int bits = 0;
+  while ((1 << bits) < size) bits++;
+
+  fourier->reverse.resize(size);
+  for (int i = 0; i < size; i++) {
+    int r = 0;
+    for (int b = 0; b < bits; b++) r |= ((i >> b) & 1) << (bits - 1 - b);
+    fourier->reverse[i] = r;
+  }
+
+  fourier->twiddle.resize(size / 2);
+  for (int i = 0; i < size / 2; i++) fourier->twiddle[i] = std::polar(1.0, -2.0 * M_PI * i / size);
+  fourier->field.resize(size);
+}
+
+// Iterative radix 2 transform, the inverse is scaled by 1 / size
+static void fdmFft(FdmFourier* fourier, complex* data, bool inverse) {
+  const int size = fourier->reverse.size();
+  for (int i = 0; i < size; i++) {
+    if (i < fourier->reverse[i]) std::swap(data[i], data[fourier->reverse[i]]);
+  }
+
+  for (int len = 2; len <= size; len <<= 1) {
+    const int half = len / 2;
+    const int step = size / len;
+    for (int i = 0; i < size; i += len) {
+      for (int j = 0; j < half; j++) {
+        complex w = fourier->twiddle[j * step];
+        if (inverse) w = std::conj(w);
+        complex u          = data[i + j];
+        complex v          = data[i + j + half] * w;
+        data[i + j]        = u + v;
+        data[i + j + half] = u - v;
+      }
+    }
+  }
+
+  if (inverse) {
+    const double scale = 1.0 / size;
+    for (int i = 0; i < size; i++) data[i] *= scale;
+  }
+}
+
+// Picks a grid spacing not larger than maxSpacing. When every source sits on
+// a multiple of the spacing the aperture is rasterized exactly, otherwise
+// sources are split linearly between their two neighbouring cells, on a grid
+// four times finer so the split attenuates the field by less than 2%.
+static double fdmApertureSpacing(const FdmSources& sources, double maxSpacing) {
+  std::vector<double> offsets = sources.offset;
+  std::sort(offsets.begin(), offsets.end());
+
+  double unit = 0.0;
+  for (int i = 1; i < int(offsets.size()); i++) {
+    double d = offsets[i] - offsets[i - 1];
+    if (d > maxSpacing * 1e-6 && (unit == 0.0 || d < unit)) unit = d;
+  }
+  if (unit < maxSpacing * 0.5) return maxSpacing * 0.25;
+
+  double spacing = unit / std::ceil(unit / maxSpacing);
+  for (double o : offsets) {
+    double cells = (o - offsets[0]) / spacing;
+    if (std::abs(cells - std::round(cells)) > 1e-6) return maxSpacing * 0.25;
+  }
+  return spacing;
+}
+
+// Adds every source to the grid, cell i is centered at origin + i * spacing
+static void fdmAperture(const FdmSources& sources, double slitWidth, double origin, double spacing, double density, complex* field, int size) {
+  for (int j = 0; j < int(sources.offset.size()); j++) {
+    const double weight = sources.weight[j] * density;
+
+    if (slitWidth > spacing) {
+      // Box coverage of every cell by the slit, keeping its total weight
+      double begin = (sources.offset[j] - slitWidth * 0.5 - origin) / spacing + 0.5;
+      double end   = (sources.offset[j] + slitWidth * 0.5 - origin) / spacing + 0.5;
+      int    first = std::max(0, int(std::floor(begin)));
+      int    last  = std::min(size - 1, int(std::floor(end)));
+      for (int i = first; i <= last; i++) {
+        double coverage = std::min(end, double(i + 1)) - std::max(begin, double(i));
+        field[i] += weight * coverage * spacing / slitWidth;
+      }
+      continue;
+    }
+
+    double position = (sources.offset[j] - origin) / spacing;
+    int    cell     = int(std::floor(position));
+    double f        = position - cell;
+    if (f > 1.0 - 1e-6) {
+      cell++;
+      f = 0.0;
+    }
+    if (cell >= 0 && cell < size) field[cell] += weight * (1.0 - f);
+    if (f > 1e-6 && cell + 1 < size) field[cell + 1] += weight * f;
+  }
+}
+
+static double fdmSampleIntensity(const FdmFourier* fourier, double index) {
+  const int size = fourier->field.size();
+  int       i0   = int(std::floor(index));
+  double    f    = index - i0;
+  i0             = ((i0 % size) + size) % size;
+  int i1         = (i0 + 1) % size;
+  return std::norm(fourier->field[i0]) * (1.0 - f) + std::norm(fourier->field[i1]) * f;
+}
+
+void fdmFourierPlot(FdmFourier* fourier, const FdmParams& params, const FdmPlotDesc& desc, const FdmFourierDesc& fourierDesc, FdmPlot* out) {
+  FdmSources sources;
+  fdmSources(params, &sources);
+
+  const double dy     = std::pow(10.0, -desc.resolution);
+  const int    count  = desc.count > 0 ? desc.count : 0;
+  const double L      = desc.distance;
+  const double lambda = params.lambda;
+  const double yMax   = dy * count / 2;
+
+  out->x.resize(count);
+  out->y.resize(count);
+  fourier->lastMode = fourierDesc.mode;
+  if (count == 0 || sources.offset.empty()) return;
+
+  double apertureMin = sources.offset[0];
+  double apertureMax = sources.offset[0];
+  double bias        = 0.0;
+  for (int j = 0; j < int(sources.offset.size()); j++) {
+    apertureMin = std::min(apertureMin, sources.offset[j]);
+    apertureMax = std::max(apertureMax, sources.offset[j]);
+    bias += sources.weight[j] * 0.5;
+  }
+  apertureMin -= fourierDesc.slitWidth * 0.5;
+  apertureMax += fourierDesc.slitWidth * 0.5;
+  const double span = apertureMax - apertureMin;
+
+  FdmFourierMode mode = fourierDesc.mode;
+  if (mode == FDM_FOURIER_AUTO) {
+    double fresnel = (span * 0.5) * (span * 0.5) / (lambda * std::max(L, 1e-12));
+    mode           = fresnel < 0.1 ? FDM_FOURIER_FAR_FIELD : FDM_FOURIER_ANGULAR_SPECTRUM;
+    if (L <= 0.0) mode = FDM_FOURIER_ANGULAR_SPECTRUM;
+  }
+  fourier->lastMode = mode;
+
+  const double decayScale = std::pow(0.1, params.decayExponent);
+
+  if (mode == FDM_FOURIER_FAR_FIELD) {
+    // Twice oversampled with respect to the largest angle on the screen
+    double sinMax  = std::max(yMax / std::sqrt(L * L + yMax * yMax), 1e-9);
+    double spacing = fdmApertureSpacing(sources, lambda / (4.0 * sinMax));
+    double bins    = std::max({double(fourierDesc.size), count * lambda / (sinMax * spacing), 2.0 * span / spacing + 1.0});
+    int    size    = std::min(nextPowerOfTwo(bins), fourierDesc.maxSize);
+
+    fdmFftPlan(fourier, size);
+    std::fill(fourier->field.begin(), fourier->field.end(), complex(0.0));
+    fdmAperture(sources, fourierDesc.slitWidth, apertureMin, spacing, 1.0, fourier->field.data(), size);
+    fdmFft(fourier, fourier->field.data(), false);
+
+    for (int i = 0; i < count; i++) {
+      double y     = -dy * count / 2 + dy * i;
+      double r     = std::sqrt(L * L + y * y);
+      double sinT  = y / r;
+      double scale = params.decayEnabled ? decayScale / r : 1.0;
+
+      double E2 = fdmSampleIntensity(fourier, sinT / lambda * size * spacing);
+      out->x[i] = float(y);
+      out->y[i] = float((bias * bias + E2 / 8.0) * scale * scale);
+    }
+    return;
+  }
+
+  // Angular spectrum, the grid covers both the aperture and the screen and is
+  // padded twice to keep the periodic wrap out of the plotted range
+  double extent  = std::max(std::abs(apertureMin), std::abs(apertureMax)) + yMax;
+  double rMax    = std::sqrt(L * L + (span + 2.0 * yMax) * (span + 2.0 * yMax));
+  double sinMax  = std::max((span + 2.0 * yMax) / rMax, 1e-9);
+  double spacing = fdmApertureSpacing(sources, std::min(lambda / (4.0 * sinMax), lambda / 2.0));
+  int    size    = nextPowerOfTwo(std::max(double(fourierDesc.size), 4.0 * extent / spacing));
+  if (size > fourierDesc.maxSize) {
+    size    = fourierDesc.maxSize;
+    spacing = 4.0 * extent / size;
+  }
+  const double origin = -spacing * (size / 2);
+
+  fdmFftPlan(fourier, size);
+  std::fill(fourier->field.begin(), fourier->field.end(), complex(0.0));
+  fdmAperture(sources, fourierDesc.slitWidth, origin, spacing, 1.0 / spacing, fourier->field.data(), size);
+  fdmFft(fourier, fourier->field.data(), false);
+
+  // Band limited transfer function: directions that would leave the window
+  // before reaching the screen wrap around periodically, so they are dropped
+  const double window = size * spacing;
+  const double limit  = 1.0 / (lambda * std::sqrt(1.0 + (2.0 * L / window) * (2.0 * L / window)));
+  const double k2     = 1.0 / (lambda * lambda);
+  for (int m = 0; m < size; m++) {
+    double fx = (m < size / 2 ? m : m - size) / window;
+    double kz = k2 - fx * fx;
+    if (kz <= 0.0 || std::abs(fx) > limit) {
+      fourier->field[m] = 0.0;
+      continue;
+    }
+    fourier->field[m] *= std::polar(1.0, 2.0 * M_PI * std::sqrt(kz) * L);
+  }
+  fdmFft(fourier, fourier->field.data(), true);
+
+  for (int i = 0; i < count; i++) {
+    double y     = -dy * count / 2 + dy * i;
+    double r     = std::sqrt(L * L + y * y);
+    double scale = params.decayEnabled ? decayScale / r : 1.0;
+
+    // A line source spreads as cos / sqrt(lambda r), normalize it back to the
+    // unit amplitude the superposition model gives to every source
+    double norm = L > 0.0 ? lambda * r * (r * r) / (L * L) : 1.0;
+    double E2   = fdmSampleIntensity(fourier, (y - origin) / spacing) * norm;
+    out->x[i]   = float(y);
+    out->y[i]   = float((bias * bias + E2 / 8.0) * scale * scale);
+  }
+}
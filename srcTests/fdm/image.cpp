@@ -0,0 +1,186 @@
+#include "fdm.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+// Branch free float sin so the row loops below vectorize. The argument is
+// reduced by pi with a three part constant and the remainder, in [-pi/2, pi/2],
+// goes through a degree 11 polynomial with an error below 1e-7. Rounding uses
+// the 1.5 * 2^23 trick, valid while |x| < 2^22 * pi.
+static inline float fdmSin(float x) {
+  const float invPi = 0.318309886183790671538f;
+  const float pi0   = 3.140625f;
+  const float pi1   = 9.67502593994140625e-4f;
+  const float pi2   = 1.509957990978376432e-7f;
+  const float round = 12582912.0f;
+
+  float q = (x * invPi + round) - round;
+  float r = ((x - q * pi0) - q * pi1) - q * pi2;
+  float s = 1.0f - 2.0f * float(int(q) & 1);
+
+  float r2 = r * r;
+  float p  = -2.5052108385e-8f;
+  p        = p * r2 + 2.7557319224e-6f;
+  p        = p * r2 - 1.9841269841e-4f;
+  p        = p * r2 + 8.3333333333e-3f;
+  p        = p * r2 - 1.6666666667e-1f;
+  return s * (r + r * r2 * p);
+}
+
+struct FdmImageSource {
+  float offset;
+  float weight;
+};
+
+// Sources in the order the shader visits them, with the net normalization and
+// the experiment weights folded into the weight
+static void fdmImageNet(const FdmParams& params, std::vector<FdmImageSource>* out, float off, float separation, float weight) {
+  if (params.ampladaFixa) separation = separation / float(params.n);
+  float offset = -float(params.n) * separation * 0.5f + off;
+  for (int i = 0; i < params.n; i++) {
+    out->push_back({offset, weight / float(params.n)});
+    offset += separation;
+  }
+}
+
+static void fdmImageSources(const FdmParams& params, std::vector<FdmImageSource>* out) {
+  const float ampladaMul = float(params.ampladaMul);
+  out->clear();
+  switch (params.experiment) {
+    case 0:
+      out->push_back({float(-FDM_A_SEPARATION * 0.5), 0.5f});
+      out->push_back({float(FDM_A_SEPARATION * 0.5), 0.5f});
+      break;
+    case 1: fdmImageNet(params, out, 0.0f, ampladaMul * 10.0f, 1.0f); break;
+    case 2: fdmImageNet(params, out, 0.0f, ampladaMul, 1.0f); break;
+    default:
+      fdmImageNet(params, out, float(-FDM_D_OFFSET) / 2.0f, float(FDM_C_SEPARATION), 0.5f);
+      fdmImageNet(params, out, float(FDM_D_OFFSET) / 2.0f, float(FDM_C_SEPARATION), 0.5f);
+      break;
+  }
+}
+
+// Inner loop over a span for one source, decay is a template parameter so the
+// loop has no control flow. The shader bias is folded into a * sin + b.
+template <bool Decay>
+static void fdmImageSource(const float* x, float* field, int width, float sy2, float d2, float k, float tw, float a, float b, float decayScale, float weight) {
+  for (int i = 0; i < width; i++) {
+    float l     = std::sqrt(x[i] * x[i] + sy2 + d2);
+    float value = fdmSin(l * k - tw) * a + b;
+    if (Decay) value = value * (decayScale / std::sqrt(x[i] * x[i] + sy2));
+    field[i] += value * weight;
+  }
+}
+
+struct FdmImageRow {
+  std::vector<float> x;
+  std::vector<float> field;
+  std::vector<float> result;
+};
+
+// One row span of a tile. Sources are the outer loop and pixels the inner
+// one, so every inner loop is a straight float loop over the span.
+static void fdmImageSpan(const FdmParams& params, const FdmImageDesc& desc, const std::vector<FdmImageSource>& sources, float y, int width, FdmImageRow* row) {
+  const float twoPi      = 2.0f * float(M_PI);
+  const float k          = twoPi / float(params.lambda);
+  const float w          = float(FDM_C / params.lambda) * twoPi;
+  const float d2         = desc.distance * desc.distance;
+  const float decayScale = std::pow(10.0f, -float(params.decayExponent));
+  const float timeZoom   = float(1e-6 / FDM_C);
+  const float a          = desc.integration ? 1.0f : 0.5f;
+  const float b          = desc.integration ? 0.0f : 0.5f;
+
+  float* x      = row->x.data();
+  float* field  = row->field.data();
+  float* result = row->result.data();
+
+  const int steps = desc.integration ? FDM_SHADER_INTEGRATION_STEPS : 1;
+  const float wA  = float(FDM_C / FDM_A_WAVE) * twoPi;
+  const float dt  = twoPi / (float(FDM_SHADER_INTEGRATION_STEPS) * wA);
+
+  for (int i = 0; i < width; i++) result[i] = 0.0f;
+
+  float t = 0.0f;
+  for (int m = 0; m < steps; m++) {
+    const float tw = (t + desc.time * timeZoom) * w;
+    for (int i = 0; i < width; i++) field[i] = 0.0f;
+
+    for (const FdmImageSource& source : sources) {
+      const float sy  = y + source.offset;
+      const float sy2 = sy * sy;
+      if (params.decayEnabled) fdmImageSource<true>(x, field, width, sy2, d2, k, tw, a, b, decayScale, source.weight);
+      else fdmImageSource<false>(x, field, width, sy2, d2, k, tw, a, b, decayScale, source.weight);
+    }
+
+    if (desc.integration) {
+      for (int i = 0; i < width; i++) result[i] += field[i] * field[i];
+    } else {
+      for (int i = 0; i < width; i++) result[i] = field[i];
+    }
+    t += dt;
+  }
+
+  if (desc.integration) {
+    for (int i = 0; i < width; i++) result[i] /= float(FDM_SHADER_INTEGRATION_STEPS);
+  }
+}
+
+void fdmImage(const FdmParams& params, const FdmImageDesc& desc, FdmImage* out) {
+  out->width  = std::max(desc.width, 0);
+  out->height = std::max(desc.height, 0);
+  out->value.resize(size_t(out->width) * out->height);
+  out->pixels.resize(size_t(out->width) * out->height);
+  if (out->width == 0 || out->height == 0) return;
+
+  std::vector<FdmImageSource> sources;
+  fdmImageSources(params, &sources);
+
+  const int tileWidth  = std::max(desc.tileWidth, 1);
+  const int tileHeight = std::max(desc.tileHeight, 1);
+  const int tilesX     = (out->width + tileWidth - 1) / tileWidth;
+  const int tilesY     = (out->height + tileHeight - 1) / tileHeight;
+  const int tiles      = tilesX * tilesY;
+
+  int threads = desc.threads > 0 ? desc.threads : std::thread::hardware_concurrency();
+  threads     = std::max(1, std::min(threads, tiles));
+
+  // Same world coordinates as realSt(), gl_FragCoord is the pixel centre
+  // counted from the bottom left corner
+  const float scale = FDM_SHADER_ZOOM * desc.zoom;
+
+  std::atomic<int> next(0);
+  auto             worker = [&]() {
+    FdmImageRow row;
+    row.x.resize(tileWidth);
+    row.field.resize(tileWidth);
+    row.result.resize(tileWidth);
+
+    for (int tile = next++; tile < tiles; tile = next++) {
+      const int x0 = (tile % tilesX) * tileWidth;
+      const int y0 = (tile / tilesX) * tileHeight;
+      const int w  = std::min(tileWidth, out->width - x0);
+      const int h  = std::min(tileHeight, out->height - y0);
+
+      for (int i = 0; i < w; i++) row.x[i] = ((float(x0 + i) + 0.5f) / float(out->width) - 0.5f) * scale;
+
+      for (int j = 0; j < h; j++) {
+        const int   r = y0 + j;
+        const float y = ((float(out->height - 1 - r) + 0.5f) / float(out->height) - 0.5f) * scale;
+        fdmImageSpan(params, desc, sources, y, w, &row);
+
+        float*         value = &out->value[size_t(r) * out->width + x0];
+        unsigned char* pixel = &out->pixels[size_t(r) * out->width + x0];
+        for (int i = 0; i < w; i++) {
+          value[i] = row.result[i];
+          pixel[i] = (unsigned char)(std::min(std::max(row.result[i], 0.0f), 1.0f) * 255.0f + 0.5f);
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int t = 1; t < threads; t++) workers.emplace_back(worker);
+  worker();
+  for (auto& w : workers) w.join();
+}
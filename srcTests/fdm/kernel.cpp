@@ -0,0 +1,141 @@
+#include "fdm.hpp"
+#include <cmath>
+
+static void fdmNet(const FdmParams& params, FdmSources* out, double off, double separation, double weight) {
+  if (params.ampladaFixa)
+    separation = separation / double(params.n);
+  if (params.normalitzarXarxa)
+    weight = weight / double(params.n);
+
+  double offset = -double(params.n) * separation * 0.5 + off;
+  for (int i = 0; i < params.n; i++) {
+    out->offset.push_back(offset);
+    out->weight.push_back(weight);
+    offset += separation;
+  }
+}
+
+void fdmSources(const FdmParams& params, FdmSources* out) {
+  out->offset.clear();
+  out->weight.clear();
+
+  switch (params.experiment) {
+    case 0:
+      out->offset = {-FDM_A_SEPARATION * 0.5, FDM_A_SEPARATION * 0.5};
+      out->weight = {0.5, 0.5};
+      break;
+    case 1: fdmNet(params, out, 0.0, FDM_B_SEPARATION, 1.0); break;
+    case 2: fdmNet(params, out, 0.0, params.ampladaMul, 1.0); break;
+    default:
+      fdmNet(params, out, -FDM_D_OFFSET / 2.0, FDM_C_SEPARATION, 0.5);
+      fdmNet(params, out, FDM_D_OFFSET / 2.0, FDM_C_SEPARATION, 0.5);
+      break;
+  }
+}
+
+template <typename Real, bool Kahan>
+struct FdmAccumulator {
+  Real sum          = 0;
+  Real compensation = 0;
+
+  inline void add(Real value) {
+    if (Kahan) {
+      Real y       = value - compensation;
+      Real t       = sum + y;
+      compensation = (t - sum) - y;
+      sum          = t;
+    } else {
+      sum += value;
+    }
+  }
+};
+
+// Reduced mode splits every path length as l = lRef + delta, where lRef is the
+// distance from the screen sample to the aperture centre. lRef * k and t * w
+// are reduced modulo 2pi in double once per sample, and the per source
+// delta = (2 y o + o^2) / (l + lRef) is small and free of cancellation, so the
+// float sin only ever sees arguments of a few hundred radians at most.
+template <typename Real, bool Reduced, bool Kahan>
+static void fdmKernel(const FdmParams& params, const FdmSources& sources, double distance, const double* positions, float* out, int count) {
+  const double twoPi       = 2.0 * M_PI;
+  const double k           = twoPi / params.lambda;
+  const double w           = twoPi * FDM_C / params.lambda;
+  const int    steps       = params.integrationSteps > 0 ? params.integrationSteps : 1;
+  const double dt          = twoPi / (double(steps) * twoPi * FDM_C / FDM_A_WAVE);
+  const Real   decayScale  = Real(std::pow(0.1, params.decayExponent));
+  const Real   x           = Real(distance);
+  const Real   kReal       = Real(k);
+  const int    sourceCount = sources.offset.size();
+
+  std::vector<Real> timePhase(steps);
+  for (int m = 0; m < steps; m++) {
+    if (Reduced) timePhase[m] = Real(std::fmod(double(m) * dt * w, twoPi));
+    else timePhase[m] = Real(m) * Real(dt) * Real(w);
+  }
+
+  std::vector<Real> spatialPhase(sourceCount);
+  std::vector<Real> amplitude(sourceCount);
+
+  for (int i = 0; i < count; i++) {
+    const Real y        = Real(positions[i]);
+    double     lRef     = 0.0;
+    Real       phaseRef = 0;
+    if (Reduced) {
+      lRef     = std::sqrt(distance * distance + positions[i] * positions[i]);
+      phaseRef = Real(std::fmod(lRef * k, twoPi));
+    }
+
+    for (int j = 0; j < sourceCount; j++) {
+      Real o  = Real(sources.offset[j]);
+      Real yj = y + o;
+      Real l  = std::sqrt(x * x + yj * yj);
+      if (Reduced) spatialPhase[j] = phaseRef + ((Real(2) * y + o) * o / (l + Real(lRef))) * kReal;
+      else spatialPhase[j] = l * kReal;
+
+      amplitude[j] = Real(sources.weight[j]);
+      if (params.decayEnabled) amplitude[j] *= decayScale / l;
+    }
+
+    FdmAccumulator<Real, Kahan> intensity;
+    for (int m = 0; m < steps; m++) {
+      FdmAccumulator<Real, Kahan> field;
+      for (int j = 0; j < sourceCount; j++) {
+        field.add(amplitude[j] * (std::sin(spatialPhase[j] - timePhase[m]) * Real(0.5) + Real(0.5)));
+      }
+      intensity.add(field.sum * field.sum);
+    }
+    out[i] = float(intensity.sum / Real(steps));
+  }
+}
+
+template <typename Real, bool Reduced>
+static void fdmKernelDispatch(const FdmParams& params, const FdmPlotDesc& desc, const FdmSources& sources, const double* positions, float* out, int count) {
+  if (desc.kahan) fdmKernel<Real, Reduced, true>(params, sources, desc.distance, positions, out, count);
+  else fdmKernel<Real, Reduced, false>(params, sources, desc.distance, positions, out, count);
+}
+
+void fdmEvaluate(const FdmParams& params, const FdmPlotDesc& desc, const double* positions, float* out, int count) {
+  FdmSources sources;
+  fdmSources(params, &sources);
+
+  switch (desc.precision) {
+    case FDM_PRECISION_FLOAT: fdmKernelDispatch<float, false>(params, desc, sources, positions, out, count); break;
+    case FDM_PRECISION_DOUBLE: fdmKernelDispatch<double, false>(params, desc, sources, positions, out, count); break;
+    case FDM_PRECISION_FLOAT_REDUCED: fdmKernelDispatch<float, true>(params, desc, sources, positions, out, count); break;
+    default: fdmKernelDispatch<long double, false>(params, desc, sources, positions, out, count); break;
+  }
+}
+
+void fdmPlot(const FdmParams& params, const FdmPlotDesc& desc, FdmPlot* out) {
+  const double dy    = std::pow(10.0, -desc.resolution);
+  const int    count = desc.count > 0 ? desc.count : 0;
+
+  // Positions are generated from the index instead of accumulating dy
+  std::vector<double> positions(count);
+  for (int i = 0; i < count; i++) positions[i] = -dy * count / 2 + dy * i;
+
+  out->x.resize(count);
+  out->y.resize(count);
+  for (int i = 0; i < count; i++) out->x[i] = float(positions[i]);
+  fdmEvaluate(params, desc, positions.data(), out->y.data(), count);
+}
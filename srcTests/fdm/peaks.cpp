@@ -0,0 +1,137 @@
+#include "fdm.hpp"
+#include <algorithm>
+#ifdef __SSE2__
+#  include <immintrin.h>
+#endif
+
+#define FDM_PEAK_CHUNK 256
+
+// Monotonic deque over a ring buffer, front holds the index of the window max
+struct FdmSlidingMax {
+  int* ring;
+  int  mask;
+  int  head = 0;
+  int  tail = 0;
+
+  template <typename Get>
+  inline void push(int i, Get get) {
+    while (tail != head && get(ring[(tail - 1) & mask]) <= get(i)) tail--;
+    ring[tail++ & mask] = i;
+  }
+
+  inline void expire(int first) {
+    while (ring[head & mask] < first) head++;
+  }
+
+  inline int front() const { return ring[head & mask]; }
+};
+
+static int ringSize(int window) {
+  int size = 1;
+  while (size < 2 * window + 2) size <<= 1;
+  return size;
+}
+
+// Writes into out every centre c in [window, count - window) with
+// get(c) >= max(get(c - window .. c + window)), used for the envelope
+template <typename Get>
+static void fdmSlidingMaxima(Get get, int count, int window, std::vector<int>& ring, std::vector<int>* out) {
+  out->clear();
+  if (count < 2 * window + 1) return;
+
+  ring.resize(ringSize(window));
+  FdmSlidingMax deque{ring.data(), int(ring.size()) - 1};
+  for (int j = 0; j < count; j++) {
+    deque.push(j, get);
+    if (j < 2 * window) continue;
+    int c = j - window;
+    deque.expire(c - window);
+    if (get(c) >= get(deque.front())) out->push_back(c);
+  }
+}
+
+void fdmFindPeaks(const float* x, const float* y, int count, int window, FdmPeaks* out) {
+  out->peaks.clear();
+  out->envelope.clear();
+  out->spacing  = 0.0;
+  out->minValue = count > 0 ? y[0] : 0.0f;
+  out->maxValue = count > 0 ? y[0] : 0.0f;
+  if (count <= 0) return;
+  window = std::max(window, 0);
+
+  out->deque.resize(ringSize(window));
+  out->windowMax.resize(FDM_PEAK_CHUNK);
+
+  auto          get = [y](int i) { return y[i]; };
+  FdmSlidingMax deque{out->deque.data(), int(out->deque.size()) - 1};
+
+  // The stream is processed in chunks: the deque fills the window maxima of a
+  // chunk of centres, then the chunk is compared against them four at a time
+  // while it is still in cache. Range tracking rides along on the same loads.
+#ifdef __SSE2__
+  __m128 minValue = _mm_set1_ps(y[0]);
+  __m128 maxValue = _mm_set1_ps(y[0]);
+#endif
+
+  int next = 0;
+  for (int begin = 0; begin < count; begin += FDM_PEAK_CHUNK) {
+    int end = std::min(begin + FDM_PEAK_CHUNK, count);
+
+    // Window maxima for the centres of this chunk that have a full window
+    int first = std::max(begin, window);
+    int last  = std::min(end, count - window);
+    for (int c = first; c < last; c++) {
+      for (; next <= c + window; next++) deque.push(next, get);
+      deque.expire(c - window);
+      out->windowMax[c - begin] = y[deque.front()];
+    }
+
+    int i = begin;
+#ifdef __SSE2__
+    for (; i + 4 <= end; i += 4) {
+      __m128 v = _mm_loadu_ps(y + i);
+      minValue = _mm_min_ps(minValue, v);
+      maxValue = _mm_max_ps(maxValue, v);
+
+      // Lanes outside [first, last) have no window max and are masked out
+      int valid = 0;
+      for (int b = 0; b < 4; b++) valid |= (i + b >= first && i + b < last) << b;
+      if (valid == 0) continue;
+
+      int mask = valid & _mm_movemask_ps(_mm_cmpge_ps(v, _mm_loadu_ps(&out->windowMax[i - begin])));
+      while (mask) {
+        out->peaks.push_back(i + __builtin_ctz(mask));
+        mask &= mask - 1;
+      }
+    }
+#endif
+    for (; i < end; i++) {
+      out->minValue = std::min(out->minValue, y[i]);
+      out->maxValue = std::max(out->maxValue, y[i]);
+      if (i >= first && i < last && y[i] >= out->windowMax[i - begin]) out->peaks.push_back(i);
+    }
+  }
+
+#ifdef __SSE2__
+  float lanes[4];
+  _mm_storeu_ps(lanes, minValue);
+  for (float v : lanes) out->minValue = std::min(out->minValue, v);
+  _mm_storeu_ps(lanes, maxValue);
+  for (float v : lanes) out->maxValue = std::max(out->maxValue, v);
+#endif
+
+  fdmPeakEnvelope(x, y, window, out);
+}
+
+void fdmPeakEnvelope(const float* x, const float* y, int window, FdmPeaks* out) {
+  // Envelope, maxima among the peaks using the same window over peak indices
+  const std::vector<int>& peaks = out->peaks;
+  out->envelope.clear();
+  out->spacing = 0.0;
+  fdmSlidingMaxima([&](int k) { return y[peaks[k]]; }, peaks.size(), std::max(window, 0), out->deque, &out->envelope);
+  for (int& e : out->envelope) e = peaks[e];
+
+  if (out->envelope.size() > 1 && x != nullptr) {
+    out->spacing = (x[out->envelope.back()] - x[out->envelope.front()]) / double(out->envelope.size() - 1);
+  }
+}
@@ -0,0 +1,269 @@
+#include "fdm.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+/* Binary layout, little endian:
+ *   header  { char magic[4] = "FDMS"; uint32 version; uint32 points; uint32 samples; }
+ *   point   { FdmSweepRecord; float x[samples]; float y[samples]; } * points
+ * Each point stores its columns contiguously so a reader can map x / y directly.
+ */
+struct FdmSweepRecord {
+  double   lambda;
+  double   separation;
+  double   distance;
+  double   spacing;
+  float    minValue;
+  float    maxValue;
+  uint32_t n;
+  uint32_t peaks;
+};
+
+struct FdmSweepPoint {
+  FdmParams   params;
+  FdmPlotDesc plot;
+  FdmPlot     result;
+  FdmPeaks    peaks;
+  bool        ready = false;
+};
+
+static void fdmSweepPoint(const FdmSweepDesc& desc, int index, FdmSweepPoint* point, FdmFourier* fourier) {
+  int i = index;
+  int l = i % desc.lambda.count;
+  i /= desc.lambda.count;
+  int n = i % desc.n.count;
+  i /= desc.n.count;
+  int s = i % desc.separation.count;
+  i /= desc.separation.count;
+  int d = i;
+
+  point->params = desc.params;
+  point->plot   = desc.plot;
+  if (desc.lambda.count > 1) point->params.lambda = desc.lambda.value(l);
+  if (desc.n.count > 1) point->params.n = int(desc.n.value(n) + 0.5);
+  if (desc.separation.count > 1) point->params.ampladaMul = desc.separation.value(s);
+  if (desc.distance.count > 1) point->plot.distance = desc.distance.value(d);
+
+  if (desc.fourier) fdmFourierPlot(fourier, point->params, point->plot, FdmFourierDesc(), &point->result);
+  else fdmPlot(point->params, point->plot, &point->result);
+  fdmFindPeaks(point->result.x.data(), point->result.y.data(), point->result.y.size(), desc.peakWindow, &point->peaks);
+}
+
+static void fdmSweepWrite(const FdmSweepDesc& desc, FILE* file, int index, const FdmSweepPoint& point) {
+  const FdmPlot& r = point.result;
+
+  if (desc.format == FDM_SWEEP_BINARY) {
+    FdmSweepRecord record;
+    record.lambda     = point.params.lambda;
+    record.separation = point.params.ampladaMul;
+    record.distance   = point.plot.distance;
+    record.spacing    = point.peaks.spacing;
+    record.minValue   = point.peaks.minValue;
+    record.maxValue   = point.peaks.maxValue;
+    record.n          = point.params.n;
+    record.peaks      = point.peaks.peaks.size();
+    fwrite(&record, sizeof(record), 1, file);
+    if (!desc.summary) {
+      fwrite(r.x.data(), sizeof(float), r.x.size(), file);
+      fwrite(r.y.data(), sizeof(float), r.y.size(), file);
+    }
+    return;
+  }
+
+  if (desc.summary) {
+    fprintf(file, "%d,%e,%d,%e,%e,%lu,%e,%e,%e\n", index, point.params.lambda, point.params.n, point.params.ampladaMul,
+            point.plot.distance, point.peaks.peaks.size(), point.peaks.spacing, point.peaks.minValue, point.peaks.maxValue);
+    return;
+  }
+  for (size_t i = 0; i < r.x.size(); i++) {
+    fprintf(file, "%d,%e,%d,%e,%e,%e,%e\n", index, point.params.lambda, point.params.n, point.params.ampladaMul,
+            point.plot.distance, r.x[i], r.y[i]);
+  }
+}
+
+int fdmSweep(const FdmSweepDesc& desc) {
+  const int points = desc.lambda.count * desc.n.count * desc.separation.count * desc.distance.count;
+  if (points <= 0) {
+    fprintf(stderr, "[SWEEP] Empty parameter grid\n");
+    return 1;
+  }
+
+  FILE* file = fopen(desc.output, desc.format == FDM_SWEEP_BINARY ? "wb" : "w");
+  if (file == nullptr) {
+    fprintf(stderr, "[SWEEP] Error opening output %s\n", desc.output);
+    return 1;
+  }
+
+  if (desc.format == FDM_SWEEP_BINARY) {
+    uint32_t header[3] = {1, uint32_t(points), uint32_t(desc.summary ? 0 : desc.plot.count)};
+    fwrite("FDMS", 1, 4, file);
+    fwrite(header, sizeof(uint32_t), 3, file);
+  } else if (desc.summary) {
+    fprintf(file, "point,lambda,n,separation,distance,peaks,spacing,min,max\n");
+  } else {
+    fprintf(file, "point,lambda,n,separation,distance,x,intensity\n");
+  }
+
+  int threads = desc.threads > 0 ? desc.threads : std::thread::hardware_concurrency();
+  threads     = std::max(1, std::min(threads, points));
+
+  // Points are handed out in order and written in order. A worker may run at
+  // most `inFlight` points ahead of the writer, which bounds memory to a few
+  // profiles per thread no matter how large the grid is.
+  const int                  inFlight = threads * 2;
+  std::vector<FdmSweepPoint> slots(inFlight);
+  std::atomic<int>           next(0);
+  int                        written = 0;
+  std::mutex                 mutex;
+  std::condition_variable    wakeWriter;
+  std::condition_variable    wakeWorkers;
+
+  fprintf(stderr, "[SWEEP] %d points on %d threads to %s\n", points, threads, desc.output);
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&]() {
+      FdmFourier fourier;
+      FdmSweepPoint point;
+      for (int index = next++; index < points; index = next++) {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          wakeWorkers.wait(lock, [&]() { return index < written + inFlight; });
+        }
+        fdmSweepPoint(desc, index, &point, &fourier);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        std::swap(slots[index % inFlight], point);
+        slots[index % inFlight].ready = true;
+        wakeWriter.notify_one();
+      }
+    });
+  }
+
+  for (; written < points;) {
+    FdmSweepPoint point;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wakeWriter.wait(lock, [&]() { return slots[written % inFlight].ready; });
+      std::swap(point, slots[written % inFlight]);
+      slots[written % inFlight].ready = false;
+    }
+    fdmSweepWrite(desc, file, written, point);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    written++;
+    wakeWorkers.notify_all();
+  }
+
+  for (auto& worker : workers) worker.join();
+
+  // Writes are buffered, a full disk may only show up when closing
+  bool failed = ferror(file) != 0;
+  failed      = fclose(file) != 0 || failed;
+  if (failed) {
+    fprintf(stderr, "[SWEEP] Error writing output %s\n", desc.output);
+    return 1;
+  }
+  fprintf(stderr, "[SWEEP] Done\n");
+  return 0;
+}
+
+static bool parseAxis(const char* text, FdmSweepAxis* axis) {
+  char* end;
+  axis->begin = strtod(text, &end);
+  axis->end   = axis->begin;
+  axis->count = 1;
+  if (*end == 0) return true;
+  if (*end != ':') return false;
+  axis->end = strtod(end + 1, &end);
+  if (*end != ':') return false;
+  axis->count = atoi(end + 1);
+  return axis->count > 0;
+}
+
+static bool parsePositive(const char* text, int* out) {
+  char* end;
+  long  value = strtol(text, &end, 10);
+  if (*end != 0 || value <= 0 || value > INT32_MAX) return false;
+  *out = int(value);
+  return true;
+}
+
+static bool parsePrecision(const char* text, FdmPrecision* precision) {
+  char* end;
+  long  value = strtol(text, &end, 10);
+  if (*end != 0 || value < 0 || value >= FDM_PRECISION_LAST) return false;
+  *precision = FdmPrecision(value);
+  return true;
+}
+
+static void fdmSweepUsage() {
+  fprintf(stderr,
+          "usage: fdm --sweep [options]\n"
+          "  Axes take a value or begin:end:count\n"
+          "  --lambda <axis>       wavelength in meters\n"
+          "  --n <axis>            slit count\n"
+          "  --separation <axis>   slit separation in meters (experiment C)\n"
+          "  --distance <axis>     screen distance in meters\n"
+          "  --experiment <0-3>    --count <samples>  --resolution <exponent>\n"
+          "  --precision <0-3>     --kahan  --fourier  --steps <integration steps>\n"
+          "  --amplada-fixa  --normalitzar  --decay <exponent>  --window <peak window>\n"
+          "  --summary             one row per point instead of the profile\n"
+          "  --binary              binary records instead of csv, x and y in blocks per point\n"
+          "  --threads <count>     --out <path>\n");
+}
+
+int fdmSweepMain(int argc, char** argv) {
+  FdmSweepDesc desc;
+  desc.lambda.begin     = desc.params.lambda;
+  desc.n.begin          = desc.params.n;
+  desc.separation.begin = desc.params.ampladaMul;
+  desc.distance.begin   = desc.plot.distance;
+
+  for (int i = 0; i < argc; i++) {
+    const char* arg   = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    bool        ok    = true;
+
+#define SWEEP_VALUE(name) (strcmp(arg, name) == 0 && value != nullptr && ++i)
+    if (SWEEP_VALUE("--lambda")) ok = parseAxis(value, &desc.lambda);
+    else if (SWEEP_VALUE("--n")) ok = parseAxis(value, &desc.n);
+    else if (SWEEP_VALUE("--separation")) ok = parseAxis(value, &desc.separation);
+    else if (SWEEP_VALUE("--distance")) ok = parseAxis(value, &desc.distance);
+    else if (SWEEP_VALUE("--experiment")) desc.params.experiment = atoi(value);
+    else if (SWEEP_VALUE("--count")) ok = parsePositive(value, &desc.plot.count);
+    else if (SWEEP_VALUE("--resolution")) desc.plot.resolution = atof(value);
+    else if (SWEEP_VALUE("--precision")) ok = parsePrecision(value, &desc.plot.precision);
+    else if (SWEEP_VALUE("--steps")) desc.params.integrationSteps = atoi(value);
+    else if (SWEEP_VALUE("--decay")) desc.params.decayEnabled = true, desc.params.decayExponent = atof(value);
+    else if (SWEEP_VALUE("--window")) ok = parsePositive(value, &desc.peakWindow);
+    else if (SWEEP_VALUE("--threads")) desc.threads = atoi(value);
+    else if (SWEEP_VALUE("--out")) desc.output = value;
+    else if (strcmp(arg, "--kahan") == 0) desc.plot.kahan = true;
+    else if (strcmp(arg, "--fourier") == 0) desc.fourier = true;
+    else if (strcmp(arg, "--amplada-fixa") == 0) desc.params.ampladaFixa = true;
+    else if (strcmp(arg, "--normalitzar") == 0) desc.params.normalitzarXarxa = true;
+    else if (strcmp(arg, "--summary") == 0) desc.summary = true;
+    else if (strcmp(arg, "--binary") == 0) desc.format = FDM_SWEEP_BINARY;
+    else ok = false;
+#undef SWEEP_VALUE
+
+    if (!ok) {
+      fprintf(stderr, "[SWEEP] Invalid argument %s\n", arg);
+      fdmSweepUsage();
+      return 1;
+    }
+  }
+
+  desc.params.lambda     = desc.lambda.begin;
+  desc.params.n          = int(desc.n.begin + 0.5);
+  desc.params.ampladaMul = desc.separation.begin;
+  desc.plot.distance     = desc.distance.begin;
+  return fdmSweep(desc);
+}
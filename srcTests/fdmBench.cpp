@@ -0,0 +1,107 @@
+#include "fdm/fdm.hpp"
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+
+/* FDM precision benchmark */
+// Compares throughput and error of every sampling mode against the extended
+// precision reference. A mode is considered to resolve the fringes when it
+// finds the same number of windowed local maxima as the reference. The
+// Fourier solver is then timed against the double superposition. Maxima
+// that do not rise above their window by a small fraction of the plot range
+// are rounding noise on a plateau and are not counted.
+
+static int countMaxima(const std::vector<float>& data, int window = 10) {
+  float minVal = data[0];
+  float maxVal = data[0];
+  for (float v : data) {
+    minVal = std::min(minVal, v);
+    maxVal = std::max(maxVal, v);
+  }
+  float prominence = (maxVal - minVal) * 1e-3f;
+
+  int count = 0;
+  for (int i = window; i + window < int(data.size()); i++) {
+    bool  isMaxima  = true;
+    float windowMin = data[i];
+    for (int j = i - window; j <= i + window && isMaxima; j++) {
+      isMaxima  = data[j] <= data[i];
+      windowMin = std::min(windowMin, data[j]);
+    }
+    count += isMaxima && data[i] - windowMin > prominence;
+  }
+  return count;
+}
+
+static double benchmark(const FdmParams& params, const FdmPlotDesc& desc, FdmPlot* out, int repetitions) {
+  auto begin = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < repetitions; i++) fdmPlot(params, desc, out);
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double>(end - begin).count() / repetitions;
+}
+
+int main(int argc, char** argv) {
+  int repetitions = argc > 1 ? atoi(argv[1]) : 5;
+
+  FdmParams params;
+  params.experiment = 2;
+  params.n          = 10;
+
+  FdmPlotDesc desc;
+  desc.resolution = 4;
+  desc.count      = 4000;
+
+  FdmPlot reference;
+  desc.precision = FDM_PRECISION_EXTENDED;
+  desc.kahan     = true;
+  fdmPlot(params, desc, &reference);
+  int referenceMaxima = countMaxima(reference.y);
+
+  printf("%-24s %-6s %12s %12s %12s %8s\n", "mode", "kahan", "Msamples/s", "max error", "rms error", "maxima");
+  for (int precision = 0; precision < FDM_PRECISION_LAST; precision++) {
+    for (int kahan = 0; kahan < 2; kahan++) {
+      desc.precision = FdmPrecision(precision);
+      desc.kahan     = kahan;
+
+      FdmPlot result;
+      double  seconds = benchmark(params, desc, &result, repetitions);
+
+      double maxError = 0.0;
+      double rmsError = 0.0;
+      for (int i = 0; i < int(result.y.size()); i++) {
+        double e = std::abs(double(result.y[i]) - double(reference.y[i]));
+        maxError = std::max(maxError, e);
+        rmsError += e * e;
+      }
+      rmsError = std::sqrt(rmsError / result.y.size());
+
+      int maxima = countMaxima(result.y);
+      printf("%-24s %-6s %12.3f %12.3e %12.3e %4d/%-4d%s\n", FDM_PRECISION_NAMES[precision], kahan ? "yes" : "no",
+             desc.count / seconds * 1e-6, maxError, rmsError, maxima, referenceMaxima, maxima == referenceMaxima ? "" : " (fringes lost)");
+    }
+  }
+
+  // Fourier solver, sweeping N over the range of the viewer slider
+  printf("\n%-24s %6s %12s %12s\n", "solver", "N", "ms/plot", "max error");
+  FdmFourier     fourier;
+  FdmFourierDesc fourierDesc;
+  for (int n = 2; n <= 50; n += 16) {
+    params.n = n;
+
+    FdmPlot result;
+    desc.precision = FDM_PRECISION_DOUBLE;
+    desc.kahan     = false;
+    double superposition = benchmark(params, desc, &reference, repetitions);
+
+    auto begin = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < repetitions; i++) fdmFourierPlot(&fourier, params, desc, fourierDesc, &result);
+    auto   end     = std::chrono::high_resolution_clock::now();
+    double seconds = std::chrono::duration<double>(end - begin).count() / repetitions;
+
+    double maxError = 0.0;
+    for (int i = 0; i < int(result.y.size()); i++) maxError = std::max(maxError, std::abs(double(result.y[i]) - double(reference.y[i])));
+    printf("%-24s %6d %12.3f %12s\n", "Superposition", n, superposition * 1e3, "-");
+    printf("%-24s %6d %12.3f %12.3e\n", FDM_FOURIER_NAMES[fourier.lastMode], n, seconds * 1e3, maxError);
+  }
+}
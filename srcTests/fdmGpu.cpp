@@ -0,0 +1,195 @@
+#include "fdmGpu.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+using namespace NextVideo;
+
+void fdmGpuProfileInit(FdmGpuProfile* gpu) {
+  gpu->profileProgram = glUtilLoadProgram("assets/filter.vs", "assets/fdmProfile.glsl");
+  gpu->reduceProgram  = glUtilLoadProgram("assets/filter.vs", "assets/fdmReduce.glsl");
+
+  GLuint p         = gpu->profileProgram;
+  gpu->iCount      = glGetUniformLocation(p, "iCount");
+  gpu->iWidth      = glGetUniformLocation(p, "iWidth");
+  gpu->iStart      = glGetUniformLocation(p, "iStart");
+  gpu->iStep       = glGetUniformLocation(p, "iStep");
+  gpu->iDistance   = glGetUniformLocation(p, "iDistance");
+  gpu->iK          = glGetUniformLocation(p, "iK");
+  gpu->iPhaseRef   = glGetUniformLocation(p, "iPhaseRef");
+  gpu->iDecayMode  = glGetUniformLocation(p, "iDecayMode");
+  gpu->iDecayScale = glGetUniformLocation(p, "iDecayScale");
+  gpu->iSteps      = glGetUniformLocation(p, "iSteps");
+  gpu->iTimePhase  = glGetUniformLocation(p, "iTimePhase");
+  gpu->iSources    = glGetUniformLocation(p, "iSources");
+  gpu->iOffset     = glGetUniformLocation(p, "iOffset");
+  gpu->iWeight     = glGetUniformLocation(p, "iWeight");
+
+  GLuint r      = gpu->reduceProgram;
+  gpu->rProfile = glGetUniformLocation(r, "iProfile");
+  gpu->rCount   = glGetUniformLocation(r, "iCount");
+  gpu->rWidth   = glGetUniformLocation(r, "iWidth");
+  gpu->rBucket  = glGetUniformLocation(r, "iBucket");
+  gpu->rWindow  = glGetUniformLocation(r, "iWindow");
+
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &gpu->maxTextureSize);
+  glGenVertexArrays(1, &gpu->vao);
+  glGenTextures(1, &gpu->profileTexture);
+  glGenTextures(1, &gpu->bucketTexture);
+  glGenFramebuffers(1, &gpu->profileFbo);
+  glGenFramebuffers(1, &gpu->bucketFbo);
+
+  for (int i = 0; i < FDM_GPU_READBACKS; i++) {
+    glGenBuffers(1, &gpu->readbacks[i].pbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, gpu->readbacks[i].pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, FDM_GPU_BUCKETS * 4 * sizeof(GLuint), NULL, GL_STREAM_READ);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+static void fdmGpuTarget(GLuint fbo, GLuint texture, GLenum internal, GLenum format, GLenum type, int width, int height) {
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, internal, width, height, 0, format, type, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+  VERIFY(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE, "FDM profile target incomplete\n");
+}
+
+bool fdmGpuProfileDispatch(FdmGpuProfile* gpu, const FdmParams& params, const FdmPlotDesc& desc, int window) {
+  FdmGpuReadback& readback = gpu->readbacks[gpu->next];
+  if (readback.fence != 0 || desc.count <= 0) return false;
+
+  const int count   = desc.count;
+  const int width   = std::min(count, gpu->maxTextureSize);
+  const int height  = (count + width - 1) / width;
+  const int bucket  = (count + FDM_GPU_BUCKETS - 1) / FDM_GPU_BUCKETS;
+  const int buckets = (count + bucket - 1) / bucket;
+  VERIFY(height <= gpu->maxTextureSize, "FDM profile count too large\n");
+
+  if (width != gpu->width || height != gpu->height) {
+    fdmGpuTarget(gpu->profileFbo, gpu->profileTexture, GL_R32F, GL_RED, GL_FLOAT, width, height);
+    gpu->width  = width;
+    gpu->height = height;
+  }
+  if (buckets != gpu->buckets) {
+    fdmGpuTarget(gpu->bucketFbo, gpu->bucketTexture, GL_RGBA32UI, GL_RGBA_INTEGER, GL_UNSIGNED_INT, buckets, 1);
+    gpu->buckets = buckets;
+  }
+
+  // Phases that need double are reduced here, the shader only sees small ones
+  FdmSources sources;
+  fdmSources(params, &sources);
+  const int    sourceCount = std::min<int>(sources.offset.size(), FDM_GPU_MAX_SOURCES);
+  const int    steps       = std::max(1, std::min(params.integrationSteps, FDM_GPU_MAX_STEPS));
+  const double twoPi       = 2.0 * M_PI;
+  const double k           = twoPi / params.lambda;
+  const double w           = twoPi * FDM_C / params.lambda;
+  const double dt          = twoPi / (double(steps) * twoPi * FDM_C / FDM_A_WAVE);
+  const double dy          = std::pow(10.0, -desc.resolution);
+
+  float offset[FDM_GPU_MAX_SOURCES];
+  float weight[FDM_GPU_MAX_SOURCES];
+  float timePhase[FDM_GPU_MAX_STEPS];
+  for (int j = 0; j < sourceCount; j++) {
+    offset[j] = float(sources.offset[j]);
+    weight[j] = float(sources.weight[j]);
+  }
+  for (int m = 0; m < steps; m++) timePhase[m] = float(std::fmod(double(m) * dt * w, twoPi));
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  glBindVertexArray(gpu->vao);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, gpu->profileFbo);
+  glViewport(0, 0, width, height);
+  glUseProgram(gpu->profileProgram);
+  glUniform1i(gpu->iCount, count);
+  glUniform1i(gpu->iWidth, width);
+  glUniform1f(gpu->iStart, float(-dy * count / 2));
+  glUniform1f(gpu->iStep, float(dy));
+  glUniform1f(gpu->iDistance, float(desc.distance));
+  glUniform1f(gpu->iK, float(k));
+  glUniform1f(gpu->iPhaseRef, float(std::fmod(desc.distance * k, twoPi)));
+  glUniform1i(gpu->iDecayMode, params.decayEnabled);
+  glUniform1f(gpu->iDecayScale, float(std::pow(0.1, params.decayExponent)));
+  glUniform1i(gpu->iSteps, steps);
+  glUniform1fv(gpu->iTimePhase, steps, timePhase);
+  glUniform1i(gpu->iSources, sourceCount);
+  glUniform1fv(gpu->iOffset, sourceCount, offset);
+  glUniform1fv(gpu->iWeight, sourceCount, weight);
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, gpu->bucketFbo);
+  glViewport(0, 0, buckets, 1);
+  glUseProgram(gpu->reduceProgram);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, gpu->profileTexture);
+  glUniform1i(gpu->rProfile, 0);
+  glUniform1i(gpu->rCount, count);
+  glUniform1i(gpu->rWidth, width);
+  glUniform1i(gpu->rBucket, bucket);
+  glUniform1i(gpu->rWindow, window);
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+
+  // Queue the copy into the pixel buffer, it completes asynchronously
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+  glReadPixels(0, 0, buckets, 1, GL_RGBA_INTEGER, GL_UNSIGNED_INT, 0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  readback.fence      = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  readback.desc       = desc;
+  readback.buckets    = buckets;
+  readback.bucketSize = bucket;
+  gpu->next           = (gpu->next + 1) % FDM_GPU_READBACKS;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glBindVertexArray(0);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+  return true;
+}
+
+bool fdmGpuProfileRead(FdmGpuProfile* gpu, FdmGpuResult* out) {
+  bool updated = false;
+
+  // Drains every finished slot in order, keeping only the newest result
+  while (gpu->readbacks[gpu->read].fence != 0) {
+    FdmGpuReadback& readback = gpu->readbacks[gpu->read];
+    GLenum          status   = glClientWaitSync(readback.fence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+    glDeleteSync(readback.fence);
+    readback.fence = 0;
+    gpu->read      = (gpu->read + 1) % FDM_GPU_READBACKS;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+    const GLuint* data = (const GLuint*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, readback.buckets * 4 * sizeof(GLuint), GL_MAP_READ_BIT);
+    if (data == nullptr) {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      continue;
+    }
+
+    const double dy    = std::pow(10.0, -readback.desc.resolution);
+    const int    count = readback.desc.count;
+    out->count         = count;
+    out->max.x.resize(readback.buckets);
+    out->max.y.resize(readback.buckets);
+    out->min.resize(readback.buckets);
+    out->peaks.clear();
+    out->peakCount = 0;
+    for (int b = 0; b < readback.buckets; b++) {
+      const GLuint* bucket = &data[b * 4];
+      float         range[2];
+      memcpy(range, bucket, sizeof(range));
+      out->min[b]   = range[0];
+      out->max.y[b] = range[1];
+      out->max.x[b] = float(-dy * count / 2 + dy * double(bucket[2]));
+      out->minValue = b == 0 ? range[0] : std::min(out->minValue, range[0]);
+      out->maxValue = b == 0 ? range[1] : std::max(out->maxValue, range[1]);
+      out->peakCount += int(bucket[3]);
+      if (bucket[3] > 0) out->peaks.push_back(b);
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    updated = true;
+  }
+  return updated;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <video.hpp>
+#include "fdm/fdm.hpp"
+
+/* GPU PROFILE */
+// Evaluates the plot with assets/fdmProfile.glsl into a GL_R32F target and
+// reduces it with assets/fdmReduce.glsl into at most FDM_GPU_BUCKETS
+// GL_RGBA32UI texels.
+// Only the reduced buckets are read back, through a ring of pixel buffers
+// polled with fences, so results arrive a frame or two after dispatch and
+// the CPU never waits on the GPU.
+#define FDM_GPU_MAX_SOURCES 128
+#define FDM_GPU_MAX_STEPS   64
+#define FDM_GPU_BUCKETS     4096
+#define FDM_GPU_READBACKS   3
+
+struct FdmGpuResult {
+  FdmPlot          max;      // Per bucket maximum, at the position of the maximum
+  std::vector<float> min;    // Per bucket minimum
+  std::vector<int> peaks;    // Buckets holding at least one local maximum
+  int              peakCount = 0;
+  float            minValue  = 0.0f;
+  float            maxValue  = 0.0f;
+  int              count     = 0; // Samples evaluated
+};
+
+struct FdmGpuReadback {
+  GLuint      pbo;
+  GLsync      fence = 0;
+  FdmPlotDesc desc;
+  int         buckets;
+  int         bucketSize;
+};
+
+struct FdmGpuProfile {
+  GLuint profileProgram;
+  GLuint reduceProgram;
+  GLuint vao;
+  GLuint profileTexture;
+  GLuint bucketTexture;
+  GLuint profileFbo;
+  GLuint bucketFbo;
+  int    width          = 0;
+  int    height         = 0;
+  int    buckets        = 0;
+  int    maxTextureSize = 0;
+
+  FdmGpuReadback readbacks[FDM_GPU_READBACKS];
+  int            next = 0; // Next readback slot to dispatch into
+  int            read = 0; // Oldest slot in flight
+
+  GLint iCount, iWidth, iStart, iStep, iDistance, iK, iPhaseRef, iDecayMode, iDecayScale, iSteps, iTimePhase, iSources, iOffset, iWeight;
+  GLint rProfile, rCount, rWidth, rBucket, rWindow;
+};
+
+void fdmGpuProfileInit(FdmGpuProfile* gpu);
+// Skips the dispatch and returns false when every readback slot is in flight
+bool fdmGpuProfileDispatch(FdmGpuProfile* gpu, const FdmParams& params, const FdmPlotDesc& desc, int window);
+// Returns true when a new result was copied into out
+bool fdmGpuProfileRead(FdmGpuProfile* gpu, FdmGpuResult* out);
@@ -0,0 +1,106 @@
+#include <linear.hpp>
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include <stdio.h>
+
+/* Batched math benchmark */
+// Times every lin:: batch kernel against the equivalent plain glm loop over
+// the same random affine transforms and reports the largest difference.
+
+static const int COUNT = 1 << 16;
+
+template <typename F>
+static double timeit(int repetitions, F f) {
+  auto begin = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < repetitions; i++) f();
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double>(end - begin).count() / repetitions;
+}
+
+static float maxError(const float* a, const float* b, int count) {
+  float error = 0.0f;
+  for (int i = 0; i < count; i++) error = std::max(error, std::abs(a[i] - b[i]));
+  return error;
+}
+
+static void report(const char* name, double glmTime, double linTime, float error) {
+  printf("%-18s %10.2f %10.2f %8.2fx %12.3e\n", name, glmTime / COUNT * 1e9, linTime / COUNT * 1e9, glmTime / linTime, error);
+}
+
+int main(int argc, char** argv) {
+  int repetitions = argc > 1 ? atoi(argv[1]) : 20;
+
+  std::mt19937                          rng(7);
+  std::uniform_real_distribution<float> uniform(-10.0f, 10.0f);
+  std::uniform_real_distribution<float> positive(0.5f, 2.0f);
+
+  std::vector<glm::mat4> model(COUNT);
+  std::vector<glm::vec3> points(COUNT);
+  for (int i = 0; i < COUNT; i++) {
+    glm::vec3 axis = glm::normalize(glm::vec3(uniform(rng), uniform(rng), uniform(rng)));
+    model[i]       = lin::translate(uniform(rng), uniform(rng), uniform(rng)) * lin::rotate(axis, uniform(rng)) *
+               lin::scale(glm::vec3(positive(rng), positive(rng), positive(rng)));
+    points[i] = glm::vec3(uniform(rng), uniform(rng), uniform(rng));
+  }
+  glm::mat4 viewProj = lin::proj(16.0f / 9.0f) * lin::view(glm::vec3(1, 2, 3), glm::normalize(glm::vec3(-1, -1, -2)));
+  lin::AABB box      = {glm::vec3(-1, -2, -0.5), glm::vec3(1, 0.5, 2)};
+
+  printf("%-18s %10s %10s %9s %12s\n", "kernel", "glm ns", "lin ns", "speedup", "max error");
+
+  // Model view projection for every instance
+  {
+    std::vector<glm::mat4> a(COUNT), b(COUNT);
+    double                 g = timeit(repetitions, [&]() {
+      for (int i = 0; i < COUNT; i++) a[i] = viewProj * model[i];
+    });
+    double                 l = timeit(repetitions, [&]() { lin::mul(viewProj, model.data(), b.data(), COUNT); });
+    report("mul", g, l, maxError(&a[0][0][0], &b[0][0][0], COUNT * 16));
+  }
+
+  {
+    std::vector<glm::vec3> a(COUNT), b(COUNT);
+    double                 g = timeit(repetitions, [&]() {
+      for (int i = 0; i < COUNT; i++) a[i] = glm::vec3(model[0] * glm::vec4(points[i], 1.0f));
+    });
+    double                 l = timeit(repetitions, [&]() { lin::transformPoints(model[0], points.data(), b.data(), COUNT); });
+    report("transformPoints", g, l, maxError(&a[0].x, &b[0].x, COUNT * 3));
+  }
+
+  // Plain glm transforms the eight corners and takes their bounds
+  {
+    std::vector<lin::AABB> a(COUNT), b(COUNT);
+    double                 g = timeit(repetitions, [&]() {
+      for (int i = 0; i < COUNT; i++) {
+        glm::vec3 lo(1e30f), hi(-1e30f);
+        for (int c = 0; c < 8; c++) {
+          glm::vec3 corner(c & 1 ? box.max.x : box.min.x, c & 2 ? box.max.y : box.min.y, c & 4 ? box.max.z : box.min.z);
+          glm::vec3 p = glm::vec3(model[i] * glm::vec4(corner, 1.0f));
+          lo          = glm::min(lo, p);
+          hi          = glm::max(hi, p);
+        }
+        a[i] = {lo, hi};
+      }
+    });
+    double                 l = timeit(repetitions, [&]() { lin::transformAABB(model.data(), box, b.data(), COUNT); });
+    report("transformAABB", g, l, maxError(&a[0].min.x, &b[0].min.x, COUNT * 6));
+  }
+
+  {
+    std::vector<glm::mat4> a(COUNT), b(COUNT);
+    double                 g = timeit(repetitions, [&]() {
+      for (int i = 0; i < COUNT; i++) a[i] = glm::inverse(model[i]);
+    });
+    double                 l = timeit(repetitions, [&]() { lin::inverseAffine(model.data(), b.data(), COUNT); });
+    report("inverseAffine", g, l, maxError(&a[0][0][0], &b[0][0][0], COUNT * 16));
+  }
+
+  {
+    std::vector<glm::mat3> a(COUNT), b(COUNT);
+    double                 g = timeit(repetitions, [&]() {
+      for (int i = 0; i < COUNT; i++) a[i] = glm::transpose(glm::inverse(glm::mat3(model[i])));
+    });
+    double                 l = timeit(repetitions, [&]() { lin::normalMatrix(model.data(), b.data(), COUNT); });
+    report("normalMatrix", g, l, maxError(&a[0][0][0], &b[0][0][0], COUNT * 9));
+  }
+}
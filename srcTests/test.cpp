@@ -35,6 +35,10 @@ void updateScene(Scene* scene, SurfaceInput input) {
 }
 
 int main() {
+  // Read while the window opens and the renderer compiles its programs
+  filePrefetch("assets/equi2.png");
+  filePrefetch("assets/checker.png");
+
   SurfaceDesc surf_desc;
   surf_desc.width   = 800;
   surf_desc.height  = 600;